@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <dirent.h>
 #include <errno.h>
@@ -10,8 +11,19 @@
 #include <sys/stat.h>
 
 #include <unistd.h>
+#if !defined(WIN32)
+#include <sys/mman.h>
+#endif
 
 #include "json.h"
+#include "jsonstream.h"
+#include "process.h"
+#include "depfile.h"
+#include "buildlog.h"
+#include "objcache.h"
+#include "graph.h"
+#include "watch.h"
+#include "trace.h"
 
 typedef struct cpp_file {
     bool linkable;
@@ -25,31 +37,72 @@ typedef struct cpp_file {
 } cpp_file;
 
 
+typedef enum target_type {
+    EXECUTABLE,
+    STATIC_LIB,
+    SHARED_LIB
+} target_type;
+
+typedef struct build_target {
+    target_type type;
+    char* name;
+    char* linker;
+    char* libs;
+    char** sources; // vector of cpp_source names (or their targets), NULL for the default target
+    char** depends; // vector of names of other targets
+    size_t* objects; // vector of indices in cpp_source
+    size_t* inputs; // vector of indices in targets
+} build_target;
+
+typedef enum job_stage {
+    STAGE_COMPILE,
+    STAGE_PREPROCESS, // output goes to the object cache key
+    STAGE_LINK
+} job_stage;
+
+typedef enum job_result {
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED
+} job_result;
+
+// one running process of the build graph
+typedef struct build_job {
+    process proc;
+    size_t node;
+    cpp_file* file; // NULL for links
+    build_target* target; // NULL for compiles
+    int64_t start; // trace_now() of the current stage
+    int slot; // worker slot, the thread of its trace events
+    job_stage stage;
+    uint64_t key; // object cache key, 0 if the object is not cached
+} build_job;
+
+
+// json-files from this size per core on are streamed, smaller ones
+// are mapped and their large arrays parsed on every core
+#define CONFIG_STREAM_MIN (4*1024*1024)
+
+json_document config; // the json-file, its strings are used by the globals
+json_builder streamed; // the json-file without cpp_source, if it was streamed
+// cache settings of the json-file itself, before the environment is applied
+char* config_cache_dir;
+bool config_cache_direct;
 json_child handler;
 char *indir, *outdir, *targetdir, *compiler, *linker, *format, *libs, *cflags, *target;
+char *archiver = "ar";
 cpp_file* cpp_source; // vectors
-
-struct stat _lasttime;
-time_t lastUpdateTime(const char* filename) {
-    if(stat(filename, &_lasttime)==0) {
-        return _lasttime.st_mtime;
-    }
-    return time(NULL);
-}
-
-bool file_exists (const char* name) {
-    FILE* file;
-    if (file = fopen(name, "r")) {
-        fclose(file);
-        return true;
-    }
-    return false;   
-}
+build_target* targets; // vector
+size_t jobs = 1;
+bool* job_slots; // busy worker slots of the running build
+bool use_depfiles = true;
+bool watching = false; // rebuild on every change, pages are destroyed only at exit
+char* manifest; // path of build.json
 
 bool error(const char* message) {
     fprintf(stdout, message);
     fprintf(stderr, message);
-    destroy_pages();
+    // the state is still used, by the trace of a failed build or the watch loop
     return false;
 }
 
@@ -71,6 +124,14 @@ bool cmd_exec(const char* command) {
     return result==0;
 }
 
+size_t online_cpus() {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return n;
+#endif
+    return 1;
+}
+
 bool makedir(const char* filename) {
 #if defined(WIN32)
     // printf("Windows\n");
@@ -95,32 +156,482 @@ bool in_vector(char* string, char** vector, size_t size) {
     return false;
 }
 
+// finds value of option given as "-j N", "-jN", "--jobs N" or "--jobs=N"
+// @return index of the argument holding the value, 0 if not found
+int option_value(char* shortname, char* longname, char** argv, int argc, char** value) {
+    size_t shortlen = strlen(shortname), longlen = strlen(longname);
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], shortname)==0 || strcmp(argv[i], longname)==0) {
+            if (i+1 >= argc) return 0;
+            *value = argv[i+1];
+            return i+1;
+        }
+        if (strncmp(argv[i], longname, longlen)==0 && argv[i][longlen]=='=') {
+            *value = argv[i]+longlen+1;
+            return i;
+        }
+        if (strncmp(argv[i], shortname, shortlen)==0 && argv[i][shortlen]!='\0' && argv[i][1]!='-') {
+            *value = argv[i]+shortlen;
+            return i;
+        }
+    }
+    return 0;
+}
+
 void print_info_about() {
     printf("-b \t builds the binaries\n--build\n\n"
     "-fb \t forcefully recompiles to obj files, even if already exists, then builds the binaries\n--force_build\n\n"
     "-r \t recompiles obj files\n--recompile\n\n"
-    "-fr \t forcefully recompiles to obj files, even if already exists\n--force_recompile\n\n");
+    "-fr \t forcefully recompiles to obj files, even if already exists\n--force_recompile\n\n"
+    "-j N \t runs up to N compilers and linkers at once (default: number of online CPUs)\n--jobs N\n\n"
+    "-w \t after building, rebuilds every time an input or the json-file changes\n--watch\n\n"
+    "--trace FILE \t writes a Chrome trace (chrome://tracing, Perfetto) of the build to FILE\n\n");
 }
 
-bool spec_recompile(cpp_file* file) {
-    char buff[256];
-    size_t cursor = 0;
-    sprintf(buff+cursor, "%s %s %s%s%s ", file->compiler, file->cflags, indir, file->name, file->format);
-    cursor = strlen(buff);
+size_t object_path(cpp_file* file, char* buff, size_t size) {
+    if (file->target) return snprintf(buff, size, "%s%s", outdir, file->target);
+    return snprintf(buff, size, "%s%s.o", outdir, file->name);
+}
 
-    if (file->libs) {
-        sprintf(buff+cursor, "%s ", file->libs);
-        cursor = strlen(buff);
+size_t depfile_path(cpp_file* file, char* buff, size_t size) {
+    if (file->target) return snprintf(buff, size, "%s%s.d", outdir, file->target);
+    return snprintf(buff, size, "%s%s.d", outdir, file->name);
+}
+
+// @return NULL-terminated vector of compiler arguments
+char** spec_args(cpp_file* file) {
+    char buff[512];
+    char** args = args_new();
+    args = args_split(args, file->compiler);
+    args = args_split(args, file->cflags);
+    if (use_depfiles) {
+        // the direct mode manifest is made from the depfile, system headers must be in it too
+        args = args_add(args, (objcache_dir && objcache_direct) ? "-MD" : "-MMD");
+        args = args_add(args, "-MF");
+        depfile_path(file, buff, sizeof(buff));
+        args = args_add(args, buff);
     }
+    snprintf(buff, sizeof(buff), "%s%s%s", indir, file->name, file->format);
+    args = args_add(args, buff);
+    args = args_split(args, file->libs);
+    args = args_add(args, "-o");
+    object_path(file, buff, sizeof(buff));
+    args = args_add(args, buff);
+    return args;
+}
 
-    if (file->target) sprintf(buff+cursor, "-o %s%s ", outdir, file->target);
-    else sprintf(buff+cursor, "-o %s%s.o ", outdir, file->name);
-    cursor = strlen(buff);
+uint64_t args_hash(char** args) {
+    char* line = args_join(args);
+    uint64_t hash = hash_string(line, HASH_SEED);
+    memfree(line);
+    return hash;
+}
 
-    return cmd_exec(buff);
+// remembers inputs of the object: source, listed dependencies and the depfile
+void record_object(cpp_file* file) {
+    char buff[512];
+    char** args = spec_args(file);
+    object_path(file, buff, sizeof(buff));
+    build_record* record = buildlog_record(buff, args_hash(args));
+    args_free(args);
+
+    snprintf(buff, sizeof(buff), "%s%s%s", indir, file->name, file->format);
+    buildlog_add_input(record, buff);
+    if (file->dependencies) {
+        vector_metainfo dep_mt = vec_meta(file->dependencies);
+        for (int j=0; j<dep_mt.length; j++) buildlog_add_input(record, file->dependencies[j]);
+    }
+    depfile dep;
+    depfile_path(file, buff, sizeof(buff));
+    if (use_depfiles && depfile_read(buff, &dep)) {
+        vector_metainfo dep_mt = vec_meta(dep.deps);
+        for (int j=0; j<dep_mt.length; j++) buildlog_add_input(record, dep.deps[j]);
+        depfile_free(&dep);
+    }
+    buildlog_finish(record);
 }
 
-bool recompile(bool force) {
+size_t preprocessed_path(cpp_file* file, char* buff, size_t size) {
+    if (file->target) return snprintf(buff, size, "%s%s.i", outdir, file->target);
+    return snprintf(buff, size, "%s%s.i", outdir, file->name);
+}
+
+// @return arguments running only the preprocessor into outdir
+char** preprocess_args(cpp_file* file) {
+    char buff[512];
+    char** args = args_new();
+    args = args_split(args, file->compiler);
+    args = args_split(args, file->cflags);
+    args = args_add(args, "-E");
+    snprintf(buff, sizeof(buff), "%s%s%s", indir, file->name, file->format);
+    args = args_add(args, buff);
+    args = args_add(args, "-o");
+    preprocessed_path(file, buff, sizeof(buff));
+    args = args_add(args, buff);
+    return args;
+}
+
+void print_done(cpp_file* file, const char* how) {
+    printf("\t\033[34m %s%s\033[0m -> ", file->name, file->format); 
+    if (file->target) printf("\033[34m%s:\033[0m", file->target);
+    else printf("\033[34m%s.o:\033[0m", file->name);
+    printf("\t %s\n", how);
+    fflush(stdout);
+}
+
+// direct mode looks the object up without starting anything
+// @return true if the object was taken from the cache
+bool fetch_direct(cpp_file* file) {
+    char source[512], object[512], dep[512];
+    char** args = spec_args(file);
+    uint64_t base = objcache_base(args);
+    args_free(args);
+    snprintf(source, sizeof(source), "%s%s%s", indir, file->name, file->format);
+    object_path(file, object, sizeof(object));
+    depfile_path(file, dep, sizeof(dep));
+    if (!objcache_fetch(objcache_key_source(base, source), object, dep)) return false;
+    print_done(file, "cached");
+    record_object(file);
+    return true;
+}
+
+bool start_compile(build_job* job) {
+    char buff[512];
+    char** args = spec_args(job->file);
+    job->stage = STAGE_COMPILE;
+    // the object may be a hard link into the cache, never write through it
+    object_path(job->file, buff, sizeof(buff));
+    if (objcache_dir) remove(buff);
+    bool result = proc_start(&job->proc, args);
+    args_free(args);
+    return result;
+}
+
+bool spec_recompile(cpp_file* file, build_job* job, bool force) {
+    char buff[512];
+    job->file = file;
+    job->key = 0;
+    job->start = trace_now();
+    if (!objcache_dir) return start_compile(job);
+
+    char** args = spec_args(file);
+    job->key = objcache_base(args);
+    args_free(args);
+    if (objcache_direct) {
+        snprintf(buff, sizeof(buff), "%s%s%s", indir, file->name, file->format);
+        job->key = objcache_key_source(job->key, buff);
+        return start_compile(job);
+    }
+    // forced builds bypass the cache
+    if (force) {
+        job->key = 0;
+        return start_compile(job);
+    }
+
+    args = preprocess_args(file);
+    job->stage = STAGE_PREPROCESS;
+    bool result = proc_start(&job->proc, args);
+    args_free(args);
+    return result;
+}
+
+// preprocessing finished: take the object from the cache or compile it
+// @return true if the job is done
+bool preprocessed(build_job* job) {
+    char buff[512], dep[512];
+    preprocessed_path(job->file, buff, sizeof(buff));
+    uint64_t base = job->key;
+    job->key = 0;
+    if (job->proc.status == 0) job->key = objcache_key_preprocessed(base, buff);
+    remove(buff);
+    proc_free(&job->proc);
+
+    object_path(job->file, buff, sizeof(buff));
+    depfile_path(job->file, dep, sizeof(dep));
+    if (job->key && objcache_fetch(job->key, buff, dep)) {
+        job->proc.status = 0;
+        return true;
+    }
+    // a failing preprocessor is left to the compiler to report
+    if (!start_compile(job)) {
+        job->proc.status = -1;
+        return true;
+    }
+    return false;
+}
+
+// @return true if any of dependencies is newer than the object
+bool deps_changed(char** deps, int64_t objtime) {
+    vector_metainfo dep_mt = vec_meta(deps);
+    for (int j=0; j<dep_mt.length; j++) {
+        file_stat* st = stat_path(deps[j]);
+        if (!st->exists || st->mtime > objtime) {
+            printf("\tNoticed change in dependence \033[34m%s\033[0m\n", deps[j]);
+            return true;
+        }
+    }
+    return false;
+}
+
+// @return true if object of the file has to be recompiled
+bool is_stale(cpp_file* file) {
+    char buff[512];
+    object_path(file, buff, sizeof(buff));
+    file_stat* obj = stat_path(buff);
+    if (!obj->exists) return true;
+
+    build_record* record = buildlog_find(buff);
+    if (record) {
+        record->used = true;
+        char** args = spec_args(file);
+        uint64_t command = args_hash(args);
+        args_free(args);
+        if (command != record->command) {
+            printf("\tNoticed change in command of \033[34m%s\033[0m\n", record->output);
+            return true;
+        }
+        const char* changed = buildlog_changed(record);
+        if (changed) {
+            if (changed != record->output) printf("\tNoticed change in dependence \033[34m%s\033[0m\n", changed);
+            return true;
+        }
+        // dependencies added to build.json since the last build are not recorded yet
+        if (file->dependencies) {
+            vector_metainfo dep_mt = vec_meta(file->dependencies);
+            for (int j=0; j<dep_mt.length; j++) {
+                if (!buildlog_has_input(record, file->dependencies[j])) {
+                    printf("\tNoticed new dependence \033[34m%s\033[0m\n", file->dependencies[j]);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    snprintf(buff, sizeof(buff), "%s%s%s", indir, file->name, file->format);
+    if (stat_path(buff)->mtime > obj->mtime) return true;
+
+    if (file->dependencies && deps_changed(file->dependencies, obj->mtime)) return true;
+
+    if (use_depfiles) {
+        depfile dep;
+        depfile_path(file, buff, sizeof(buff));
+        // object was built without a depfile, its headers are unknown
+        if (!depfile_read(buff, &dep)) return true;
+        bool changed = deps_changed(dep.deps, obj->mtime);
+        depfile_free(&dep);
+        if (changed) return true;
+    }
+    // up to date, but not in the log yet
+    record_object(file);
+    return false;
+}
+
+size_t buildlog_path(char* buff, size_t size) {
+    return snprintf(buff, size, "%s%s", outdir, BUILDLOG_NAME);
+}
+
+size_t target_path(build_target* tgt, char* buff, size_t size) {
+    return snprintf(buff, size, "%s%s", targetdir, tgt->name);
+}
+
+// adds outputs of the libraries tgt depends on, each once
+char** add_libraries(char** paths, build_target* tgt, bool* seen) {
+    char buff[512];
+    if (!tgt->inputs) return paths;
+    vector_metainfo meta = vec_meta(tgt->inputs);
+    for (int i=0; i<meta.length; i++) {
+        size_t index = tgt->inputs[i];
+        build_target* dep = targets + index;
+        if (seen[index] || dep->type == EXECUTABLE) continue;
+        seen[index] = true;
+        target_path(dep, buff, sizeof(buff));
+        paths = args_add(paths, buff);
+        paths = add_libraries(paths, dep, seen);
+    }
+    return paths;
+}
+
+// @return vector of files the target is linked from: objects, then libraries
+char** link_inputs(build_target* tgt) {
+    char buff[512];
+    char** paths = args_new();
+    vector_metainfo meta = vec_meta(tgt->objects);
+    for (int i=0; i<meta.length; i++) {
+        object_path(cpp_source + tgt->objects[i], buff, sizeof(buff));
+        paths = args_add(paths, buff);
+    }
+    if (tgt->type == STATIC_LIB) return paths;
+
+    size_t count = vec_meta(targets).length;
+    bool* seen = memloc(sizeof(bool)*count);
+    memset(seen, 0, sizeof(bool)*count);
+    paths = add_libraries(paths, tgt, seen);
+    memfree(seen);
+    return paths;
+}
+
+char** link_args(build_target* tgt) {
+    char buff[512];
+    char** args = args_new();
+    char** inputs = link_inputs(tgt);
+    size_t count = args_count(inputs);
+    target_path(tgt, buff, sizeof(buff));
+
+    if (tgt->type == STATIC_LIB) {
+        args = args_split(args, archiver);
+        args = args_add(args, "rcs");
+        args = args_add(args, buff);
+        for (int i=0; i<count; i++) args = args_add(args, inputs[i]);
+        args_free(inputs);
+        return args;
+    }
+
+    args = args_split(args, tgt->linker);
+    if (tgt->type == SHARED_LIB) args = args_add(args, "-shared");
+    for (int i=0; i<count; i++) args = args_add(args, inputs[i]);
+    args_free(inputs);
+    args = args_split(args, tgt->libs);
+    args = args_add(args, "-o");
+    args = args_add(args, buff);
+    return args;
+}
+
+void print_linked(build_target* tgt, const char* how) {
+    printf("\t\033[35m link\033[0m -> \033[34m%s:\033[0m\t %s\n", tgt->name, how);
+    fflush(stdout);
+}
+
+// relinks only if the command, an input or the output changed since the last link
+job_result start_link(build_target* tgt, build_job* job, bool force) {
+    char buff[512];
+    char** args = link_args(tgt);
+    uint64_t command = args_hash(args);
+    target_path(tgt, buff, sizeof(buff));
+    build_record* record = buildlog_find(buff);
+    if (!force && record && record->command == command && !buildlog_changed(record)) {
+        record->used = true;
+        args_free(args);
+        print_linked(tgt, "up to date");
+        return JOB_DONE;
+    }
+    // ar only adds members, objects removed from the target must go
+    if (tgt->type == STATIC_LIB) remove(buff);
+
+    job->file = NULL;
+    job->target = tgt;
+    job->stage = STAGE_LINK;
+    job->key = command;
+    job->start = trace_now();
+    bool result = proc_start(&job->proc, args);
+    args_free(args);
+    if (!result) {
+        printf("\t\033[31mCannot start linker for %s\033[0m\n", tgt->name);
+        return JOB_FAILED;
+    }
+    return JOB_RUNNING;
+}
+
+void record_target(build_target* tgt, uint64_t command) {
+    char buff[512];
+    target_path(tgt, buff, sizeof(buff));
+    build_record* record = buildlog_record(buff, command);
+    char** inputs = link_inputs(tgt);
+    size_t count = args_count(inputs);
+    for (int i=0; i<count; i++) buildlog_add_input(record, inputs[i]);
+    args_free(inputs);
+    buildlog_finish(record);
+}
+
+// @return JOB_RUNNING if node is still being built, or its final result
+job_result start_node(size_t node, bool force, build_job* job) {
+    size_t files = vec_meta(cpp_source).length;
+    job->node = node;
+    if (node >= files) return start_link(targets + node - files, job, force);
+
+    cpp_file* file = cpp_source + node;
+    int64_t start = trace_now();
+    bool stale = force || is_stale(file);
+    trace_event(file->name, "check", TRACE_MAIN, start, trace_now());
+    if (!stale) return JOB_DONE;
+    if (!force && objcache_dir && objcache_direct && fetch_direct(file)) return JOB_DONE;
+    job->target = NULL;
+    if (!spec_recompile(file, job, force)) {
+        printf("\t\033[31mCannot start compiler for %s%s%s\033[0m\n", indir, file->name, file->format);
+        return JOB_FAILED;
+    }
+    return JOB_RUNNING;
+}
+
+// waits for one of the running jobs and prints its timing
+// @param node set to the node of the finished job
+// @return JOB_RUNNING if the job went on to its next stage
+job_result finish_job(build_job* running, size_t *count, size_t* node) {
+    process* procs[*count];
+    for (int i=0; i<*count; i++) procs[i] = &running[i].proc;
+    int i = proc_wait_any(procs, *count);
+    if (i < 0) {
+        *count = 0;
+        return JOB_FAILED;
+    }
+    int64_t stop = trace_now();
+
+    bool cached = false;
+    if (running[i].stage == STAGE_PREPROCESS) {
+        build_job* job = running+i;
+        trace_event(job->file->name, "preprocess", job->slot+1, job->start, stop);
+        if (!preprocessed(job)) {
+            job->start = trace_now();
+            return JOB_RUNNING;
+        }
+        cached = job->proc.status == 0;
+    }
+
+    build_job job = running[i];
+    running[i] = running[*count-1];
+    (*count)--;
+    *node = job.node;
+    job_slots[job.slot] = false;
+
+    char took[32];
+    snprintf(took, sizeof(took), "%lld ms", (long long) trace_ms(job.start, stop));
+    bool result = job.proc.status == 0;
+    if (job.stage == STAGE_LINK) trace_event(job.target->name, "link", job.slot+1, job.start, stop);
+    else if (!cached) trace_event(job.file->name, "compile", job.slot+1, job.start, stop);
+
+    if (job.stage == STAGE_LINK) {
+        if (result) print_linked(job.target, took);
+        else printf("\t\033[31mCannot link %s\033[0m\n", job.target->name);
+        fflush(stdout);
+        proc_print_err(&job.proc, stdout);
+        proc_free(&job.proc);
+        if (result) record_target(job.target, job.key);
+        return (result) ? JOB_DONE : JOB_FAILED;
+    }
+
+    cpp_file *file = job.file;
+    if (!result) {
+        printf("\t\033[31mCannot compile file %s%s%s\033[0m\n", indir, file->name, file->format);
+        fflush(stdout);
+    } else if (cached) {
+        print_done(file, "cached");
+    } else {
+        print_done(file, took);
+    }
+    proc_print_err(&job.proc, stdout);
+    proc_free(&job.proc);
+    if (result && !cached && job.key) {
+        char object[512], dep[512];
+        object_path(file, object, sizeof(object));
+        depfile_path(file, dep, sizeof(dep));
+        objcache_store(job.key, object, dep);
+    }
+    if (result) record_object(file);
+    return (result) ? JOB_DONE : JOB_FAILED;
+}
+
+// builds every object and, if link is set, every target in dependency order
+bool run(bool force, bool link) {
     if (!dir_exists(indir)) return error("Indir does not exist\n");
 
     
@@ -129,203 +640,674 @@ bool recompile(bool force) {
             return error("Cannot create output directory\n");
         }
     }
-    printf("\033[33mCompilation:\033[0m\n");
-    vector_metainfo meta = vec_meta(cpp_source);
-    cpp_file *file;
-    char buff[64];
-    time_t t1, t2;
-    struct timespec start, stop;
-    // printf("%d", meta.length);
+    char logpath[512];
+    buildlog_path(logpath, sizeof(logpath));
+    buildlog_load(logpath);
+
+    size_t files = vec_meta(cpp_source).length;
+    size_t target_count = (link) ? vec_meta(targets).length : 0;
+    graph g;
+    graph_init(&g, files + target_count);
+    for (size_t t=0; t<target_count; t++) {
+        build_target* tgt = targets+t;
+        vector_metainfo meta = vec_meta(tgt->objects);
+        for (int j=0; j<meta.length; j++) graph_edge(&g, tgt->objects[j], files+t);
+        meta = vec_meta(tgt->inputs);
+        for (int j=0; j<meta.length; j++) graph_edge(&g, files + tgt->inputs[j], files+t);
+    }
+    size_t cycle;
+    if (!graph_check(&g, &cycle)) {
+        printf("\t\033[31mCannot order target %s, its dependencies form a cycle\033[0m\n", targets[cycle-files].name);
+        graph_free(&g);
+        return error("Dependency cycle\n");
+    }
+
+    printf("\033[33m%s:\033[0m\n", (link) ? "Building" : "Compilation");
+    fflush(stdout);
+    bool failed = false;
+    size_t running_count = 0;
+    size_t node;
+    build_job* running = memloc(sizeof(build_job)*jobs);
+    job_slots = memloc(sizeof(bool)*jobs);
+    memset(job_slots, 0, sizeof(bool)*jobs);
+    int64_t start = trace_now();
+    graph_start(&g);
+    while (true) {
+        // stop launching after the first failure, but collect what is running
+        while (!failed && running_count < jobs && graph_pop(&g, &node)) {
+            build_job* job = running+running_count;
+            job->slot = 0;
+            while (job_slots[job->slot]) job->slot++;
+            job_result res = start_node(node, force, job);
+            if (res == JOB_RUNNING) {
+                job_slots[job->slot] = true;
+                running_count++;
+            }
+            else if (res == JOB_DONE) graph_done(&g, node);
+            else failed = true;
+        }
+        if (running_count == 0) break;
+
+        job_result res = finish_job(running, &running_count, &node);
+        if (res == JOB_DONE) graph_done(&g, node);
+        else if (res == JOB_FAILED) failed = true;
+    }
+    trace_event((link) ? "build" : "compile", "build", TRACE_MAIN, start, trace_now());
+    memfree(job_slots);
+    memfree(running);
+    graph_free(&g);
+    buildlog_save(logpath);
+    objcache_trim();
+    objcache_report();
+
+    if (failed) return error("\tBuild stopped\n");
+    return true;
+}
+
+bool recompile(bool force) {
+    return run(force, false);
+}
+
+bool build(bool force) {
+    return run(force, true);
+}
+
+// @return vector of strings of a json array of strings
+char** string_vector(json_object* obj) {
+    if (obj->type != ARRAY) return NULL;
+    vector_metainfo meta = vec_meta(obj->data.array);
+    char** vec = new_vec(sizeof(char*), meta.length);
     for (int i=0; i<meta.length; i++) {
-        file = cpp_source+i;
-        
-        if (file->target) sprintf(buff, "%s%s", outdir, file->target);
-        else sprintf(buff, "%s%s.o", outdir, file->name);
-
-        if (!force) {    
-            if (file_exists(buff)) {
-                t1 = lastUpdateTime(buff);
-                sprintf(buff, "%s%s%s", indir, file->name, file->format);
-                t2 = lastUpdateTime(buff);
-                if (t1 >= t2) {
-                    bool flag = true;
-                    if (file->dependencies) {
-                        vector_metainfo dep_mt = vec_meta(file->dependencies);
-                        for (int j=0; j<dep_mt.length; j++) {
-                            t2 = lastUpdateTime(file->dependencies[j]);
-                            if (t2 > t1) {
-                                printf("\tNoticed change in dependence \033[34m%s\033[0m\n", file->dependencies[j]);
-                                flag=false; 
-                                break;
-                            }
-                        }
-                    }
-                    if (flag) continue;
+        if (obj->data.array[i].type != STR) continue;
+        vec = vec_add(vec, &(obj->data.array[i].data.str));
+    }
+    return vec;
+}
+
+// @return string value of key, or dflt if there is none
+char* json_str(json_child* child, const char* key, char* dflt) {
+    json_object* obj = json_get(child, key);
+    return (obj && obj->type == STR) ? obj->data.str : dflt;
+}
+
+// @return number or boolean value of key, or dflt if there is none
+int64_t json_num(json_child* child, const char* key, int64_t dflt) {
+    json_object* obj = json_get(child, key);
+    if (obj && obj->type == BOOL) return obj->data.boolean;
+    return (obj && obj->type == INT) ? obj->data.num : dflt;
+}
+
+bool load_target(json_object* obj, build_target* tgt) {
+    if (obj->type != CHILD) return error("Inapropriate type of target\n");
+    json_child* child = &obj->data.child;
+    tgt->type = EXECUTABLE;
+    tgt->name = json_str(child, "name", NULL);
+    tgt->linker = json_str(child, "linker", NULL);
+    tgt->libs = json_str(child, "libs", NULL);
+    char* type = json_str(child, "type", "executable");
+    if (strcmp(type, "executable")==0) tgt->type = EXECUTABLE;
+    else if (strcmp(type, "static")==0) tgt->type = STATIC_LIB;
+    else if (strcmp(type, "shared")==0) tgt->type = SHARED_LIB;
+    else return error("Unknown target type, use \"executable\", \"static\" or \"shared\"\n");
+    json_object* list = json_get(child, "sources");
+    if (list) tgt->sources = string_vector(list);
+    list = json_get(child, "depends");
+    if (list) tgt->depends = string_vector(list);
+    if (!tgt->name) return error("Target name is not provided\n");
+    if (!tgt->sources) return error("Target sources are not provided\n");
+    return true;
+}
+
+// turns names of sources and targets into indices, applies defaults
+bool resolve_targets() {
+    vector_metainfo files = vec_meta(cpp_source);
+    vector_metainfo meta = vec_meta(targets);
+    for (int t=0; t<meta.length; t++) {
+        build_target* tgt = targets+t;
+        if (!tgt->linker) tgt->linker = linker;
+        if (!tgt->libs) tgt->libs = libs;
+        tgt->objects = new_vec(sizeof(size_t), files.length);
+        tgt->inputs = new_vec(sizeof(size_t), 0);
+
+        if (!tgt->sources) {
+            for (size_t i=0; i<files.length; i++) {
+                if (cpp_source[i].linkable) tgt->objects = vec_add(tgt->objects, &i);
+            }
+        } else {
+            // a source is named by its target if it has one, by its name otherwise
+            vector_metainfo src = vec_meta(tgt->sources);
+            for (int j=0; j<src.length; j++) {
+                size_t i;
+                for (i=0; i<files.length; i++) {
+                    cpp_file* file = cpp_source+i;
+                    if (strcmp((file->target) ? file->target : file->name, tgt->sources[j])==0) break;
                 }
+                if (i == files.length) {
+                    printf("\t\033[31mTarget %s: no source %s\033[0m\n", tgt->name, tgt->sources[j]);
+                    return error("Unknown source\n");
+                }
+                tgt->objects = vec_add(tgt->objects, &i);
             }
         }
 
-        clock_gettime(CLOCK_REALTIME, &start);
-        if (!spec_recompile(file)) {
-            sprintf(buff, "\tCannot compile file %s%s%s\n", indir, file->name, file->format);
-            return error(buff);
+        if (!tgt->depends) continue;
+        vector_metainfo dep = vec_meta(tgt->depends);
+        for (int j=0; j<dep.length; j++) {
+            size_t i;
+            for (i=0; i<meta.length; i++) {
+                if (strcmp(targets[i].name, tgt->depends[j])==0) break;
+            }
+            if (i == meta.length) {
+                printf("\t\033[31mTarget %s: no target %s\033[0m\n", tgt->name, tgt->depends[j]);
+                return error("Unknown target\n");
+            }
+            tgt->inputs = vec_add(tgt->inputs, &i);
         }
-        clock_gettime(CLOCK_REALTIME, &stop);
+    }
+    return true;
+}
 
-        printf("\t\033[34m %s%s\033[0m -> ", file->name, file->format); 
-        if (file->target) printf("\033[34m%s:\033[0m", file->target);
-        else printf("\033[34m%s.o:\033[0m", file->name);
-        printf("\t %ld ms\n", abs((stop.tv_nsec-start.tv_nsec)/1000000));
+// reads one element of cpp_source, defaults come from the globals
+bool load_source(json_object* inner, cpp_file* file) {
+    file->linkable = 1;
+    if (inner->type == CHILD) {
+        json_child* child = &inner->data.child;
+        file->target = json_str(child, "target", NULL);
+        file->format = json_str(child, "format", NULL);
+        file->name = json_str(child, "name", NULL);
+        file->compiler = json_str(child, "compiler", NULL);
+        file->cflags = json_str(child, "cflags", NULL);
+        file->libs = json_str(child, "libs", NULL);
+        file->linkable = json_num(child, "linkable", 1);
+        json_object* deps = json_get(child, "dependencies");
+        if (deps) file->dependencies = string_vector(deps);
+    } else if (inner->type == STR) {
+        file->name = inner->data.str;
+    } else {
+        return error("Inapropriate type of cpp source file\n");
     }
 
+    if (!file->name) {
+        return error("File name is not provided\n");
+    }
     return true;
 }
 
-#define BUILD_BUFFER_SIZE 512
-bool build(bool force) {
-    if (!recompile(force)) return error("Compilation error\n");
-    
-    char buff[BUILD_BUFFER_SIZE]; *buff = '\0';
-    size_t written = 0;
-    snprintf(buff+written, BUILD_BUFFER_SIZE-written, "%s ", linker);
-    written = strlen(buff);
+void source_defaults(cpp_file* file) {
+    if (!file->cflags) 
+        if (cflags && strlen(cflags)>0) file->cflags = cflags;
+        else file->cflags = "-c";
+    if (!file->libs)
+        if (libs && strlen(libs)>0) file->libs = libs;
+    if (!file->compiler) file->compiler = compiler;
+    if (!file->format) file->format = format;
+}
+
+// takes a finished element of the top-level cpp_source out of the streamed tree
+bool stream_source() {
+    vector_metainfo meta = vec_meta(streamed.stack);
+    if (meta.length != 2 || strcmp(streamed.stack[0].key, "cpp_source")!=0) return true;
+    json_object* array = streamed.stack[1].value.data.array;
+    if (streamed.stack[1].value.type != ARRAY || vec_meta(array).length == 0) return true;
+    json_object element = array[--vec_metaptr(array)->length];
+    cpp_file file = {0};
+    bool result = load_source(&element, &file);
+    if (result) {
+        if (!cpp_source) cpp_source = new_vec(sizeof(cpp_file), STANDART_PREALLOC);
+        cpp_source = vec_add(cpp_source, &file);
+    }
+    json_free_object(&element);
+    return result;
+}
+
+json_events builder_events;
+
+bool stream_end_object(void* user) {
+    return builder_events.end_object(user) && stream_source();
+}
+
+bool stream_string(void* user, const char* str, size_t len) {
+    return builder_events.on_string(user, str, len) && stream_source();
+}
+
+// elements of other types are taken out too, load_source() rejects them as the tree path does
+bool stream_end_array(void* user) {
+    return builder_events.end_array(user) && stream_source();
+}
+
+bool stream_number(void* user, json_object* value) {
+    return builder_events.on_number(user, value) && stream_source();
+}
+
+bool stream_bool(void* user, bool value) {
+    return builder_events.on_bool(user, value) && stream_source();
+}
+
+bool stream_null(void* user) {
+    return builder_events.on_null(user) && stream_source();
+}
+
+// reads the json-file in pieces, cpp_source goes into cpp_file entries
+// as it is read and only the rest of the file is kept as a tree
+bool stream_config(FILE* fd) {
+    builder_events = json_builder_events(&streamed);
+    json_events events = builder_events;
+    events.end_object = stream_end_object;
+    events.on_string = stream_string;
+    events.end_array = stream_end_array;
+    events.on_number = stream_number;
+    events.on_bool = stream_bool;
+    events.on_null = stream_null;
+    return json_stream(fd, &events);
+}
+
+#define SNAPSHOT_MAGIC "CBCFG01\n"
+#define SNAPSHOT_NULL UINT32_MAX
+
+// the resolved config, written next to the json-file after a parse and
+// mapped instead of parsing while the json-file stays the same:
+// header, files, targets, links, strings
+typedef struct snapshot_header {
+    char magic[8];
+    int64_t json_size, json_mtime;
+    uint64_t json_hash;
+    uint32_t files, targets, links, strings;
+    // offsets in strings, SNAPSHOT_NULL for NULL
+    uint32_t target, indir, outdir, targetdir, compiler, linker, format, cflags, libs, archiver, cache_dir;
+    uint32_t depfiles, hashes, direct;
+    uint64_t cache_limit;
+} snapshot_header;
+
+typedef struct snapshot_file {
+    uint32_t linkable;
+    uint32_t compiler, name, format, cflags, libs, target;
+    uint32_t deps_first, deps_count; // dependencies are string offsets in links
+} snapshot_file;
+
+typedef struct snapshot_target {
+    uint32_t type, name, linker, libs;
+    uint32_t objects_first, objects_count; // indices in links
+    uint32_t inputs_first, inputs_count;
+} snapshot_target;
+
+char* snapshot_data; // the mapped or read snapshot
+size_t snapshot_size;
+bool snapshot_mapped;
+void* snapshot_vectors; // every vector of cpp_source and targets in one block
+
+void snapshot_path(char* buff, size_t size) {
+    const char* slash = strrchr(manifest, '/');
+    if (slash) snprintf(buff, size, "%.*s/.%s.cbuild_config", (int) (slash-manifest), manifest, slash+1);
+    else snprintf(buff, size, ".%s.cbuild_config", manifest);
+}
+
+void snapshot_close() {
+    if (snapshot_vectors) memfree(snapshot_vectors);
+    snapshot_vectors = NULL;
+    if (!snapshot_data) return;
+#if !defined(WIN32)
+    if (snapshot_mapped) munmap(snapshot_data, snapshot_size);
+    else
+#endif
+    memfree(snapshot_data);
+    snapshot_data = NULL;
+}
+
+typedef struct snapshot_writer {
+    snapshot_file* files; // vector
+    snapshot_target* targets; // vector
+    uint32_t* links; // vector
+    char* strings; // vector
+    // the same pointer is usually shared by many files, it is stored once
+    const char* cached[256];
+    uint32_t offsets[256];
+} snapshot_writer;
+
+uint32_t snapshot_string(snapshot_writer* wr, const char* str) {
+    if (!str) return SNAPSHOT_NULL;
+    size_t slot = ((uintptr_t) str >> 3) & 255;
+    if (wr->cached[slot] == str) return wr->offsets[slot];
+    uint32_t offset = vec_meta(wr->strings).length;
+    wr->strings = vec_extend(wr->strings, (void*) str, strlen(str)+1);
+    wr->cached[slot] = str;
+    wr->offsets[slot] = offset;
+    return offset;
+}
+
+bool save_snapshot() {
+    char path[512], temp[520];
+    file_stat* st = stat_refresh(manifest);
+    if (!st->exists) return false;
+    snapshot_writer wr = {0};
+    wr.files = new_vec(sizeof(snapshot_file), vec_meta(cpp_source).length);
+    wr.targets = new_vec(sizeof(snapshot_target), vec_meta(targets).length);
+    wr.links = new_vec(sizeof(uint32_t), PAGE_SIZE/sizeof(uint32_t));
+    wr.strings = new_vec(sizeof(char), PAGE_SIZE);
+
+    snapshot_header header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.json_size = st->size;
+    header.json_mtime = st->mtime;
+    header.json_hash = stat_content(st);
+    header.target = snapshot_string(&wr, target);
+    header.indir = snapshot_string(&wr, indir);
+    header.outdir = snapshot_string(&wr, outdir);
+    header.targetdir = snapshot_string(&wr, targetdir);
+    header.compiler = snapshot_string(&wr, compiler);
+    header.linker = snapshot_string(&wr, linker);
+    header.format = snapshot_string(&wr, format);
+    header.cflags = snapshot_string(&wr, cflags);
+    header.libs = snapshot_string(&wr, libs);
+    header.archiver = snapshot_string(&wr, archiver);
+    header.cache_dir = snapshot_string(&wr, config_cache_dir);
+    header.depfiles = use_depfiles;
+    header.hashes = buildlog_hashes;
+    header.direct = config_cache_direct;
+    header.cache_limit = objcache_limit;
+
     vector_metainfo meta = vec_meta(cpp_source);
-    cpp_file *file;
-    
     for (int i=0; i<meta.length; i++) {
-        file = cpp_source + i;
-        if (!file->linkable) continue;
-        if (file->target) snprintf(buff+written, BUILD_BUFFER_SIZE-written, "%s%s ", outdir, file->target);
-        else snprintf(buff+written, BUILD_BUFFER_SIZE-written, "%s%s.o ", outdir, file->name);
-        written = strlen(buff);
+        cpp_file* file = cpp_source+i;
+        snapshot_file rec = {file->linkable,
+            snapshot_string(&wr, file->compiler), snapshot_string(&wr, file->name), snapshot_string(&wr, file->format),
+            snapshot_string(&wr, file->cflags), snapshot_string(&wr, file->libs), snapshot_string(&wr, file->target),
+            vec_meta(wr.links).length, SNAPSHOT_NULL};
+        if (file->dependencies) {
+            vector_metainfo deps = vec_meta(file->dependencies);
+            rec.deps_count = deps.length;
+            for (int j=0; j<deps.length; j++) {
+                uint32_t offset = snapshot_string(&wr, file->dependencies[j]);
+                wr.links = vec_add(wr.links, &offset);
+            }
+        }
+        wr.files = vec_add(wr.files, &rec);
     }
-
-    if (libs) {
-        snprintf(buff+written, BUILD_BUFFER_SIZE-written, "%s ", libs);
-        written = strlen(buff);
+    meta = vec_meta(targets);
+    for (int i=0; i<meta.length; i++) {
+        build_target* tgt = targets+i;
+        snapshot_target rec = {tgt->type, snapshot_string(&wr, tgt->name),
+            snapshot_string(&wr, tgt->linker), snapshot_string(&wr, tgt->libs)};
+        vector_metainfo list = vec_meta(tgt->objects);
+        rec.objects_first = vec_meta(wr.links).length;
+        rec.objects_count = list.length;
+        for (int j=0; j<list.length; j++) {
+            uint32_t index = tgt->objects[j];
+            wr.links = vec_add(wr.links, &index);
+        }
+        list = vec_meta(tgt->inputs);
+        rec.inputs_first = vec_meta(wr.links).length;
+        rec.inputs_count = list.length;
+        for (int j=0; j<list.length; j++) {
+            uint32_t index = tgt->inputs[j];
+            wr.links = vec_add(wr.links, &index);
+        }
+        wr.targets = vec_add(wr.targets, &rec);
     }
+    header.files = vec_meta(wr.files).length;
+    header.targets = vec_meta(wr.targets).length;
+    header.links = vec_meta(wr.links).length;
+    header.strings = vec_meta(wr.strings).length;
 
-    snprintf(buff+written, BUILD_BUFFER_SIZE-written, " -o %s%s", targetdir, target);
-    
-    printf("\033[33mLinking:\033[0m\n");
-    struct timespec start, stop;
-    clock_gettime(CLOCK_REALTIME, &start);
-    // printf("FIN LEN: %d\n", strlen(buff));
-    bool result = cmd_exec(buff);
-    if (result) {
-        clock_gettime(CLOCK_REALTIME, &stop);
-        printf("\t%ld ms\n", abs((stop.tv_nsec-start.tv_nsec)/1000000));
-        // printf("In build\n");
+    // written next to it and renamed, so an interrupted save keeps the old one
+    snapshot_path(path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    bool result = false;
+    FILE* fd = fopen(temp, "wb");
+    if (fd) {
+        result = fwrite(&header, sizeof(header), 1, fd)==1;
+        if (header.files) result &= fwrite(wr.files, sizeof(snapshot_file), header.files, fd)==header.files;
+        if (header.targets) result &= fwrite(wr.targets, sizeof(snapshot_target), header.targets, fd)==header.targets;
+        if (header.links) result &= fwrite(wr.links, sizeof(uint32_t), header.links, fd)==header.links;
+        if (header.strings) result &= fwrite(wr.strings, sizeof(char), header.strings, fd)==header.strings;
+        result &= fclose(fd)==0;
+        result = result && rename(temp, path)==0;
+        if (!result) remove(temp);
     }
-    // printf("In build2\n");
+    delete_vec(wr.files);
+    delete_vec(wr.targets);
+    delete_vec(wr.links);
+    delete_vec(wr.strings);
     return result;
 }
 
+// @return true if the snapshot is there and was made from the json-file as it is now
+bool map_snapshot(const char* path) {
+    file_stat* st = stat_refresh(manifest);
+    FILE* fd = fopen(path, "rb");
+    if (!fd || !st->exists) {
+        if (fd) fclose(fd);
+        return false;
+    }
+    fseek(fd, 0, SEEK_END);
+    snapshot_size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    snapshot_mapped = false;
+    if (snapshot_size < sizeof(snapshot_header)) {
+        fclose(fd);
+        return false;
+    }
+#if !defined(WIN32)
+    snapshot_data = mmap(NULL, snapshot_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+    if (snapshot_data == MAP_FAILED) snapshot_data = NULL;
+    else snapshot_mapped = true;
+#endif
+    if (!snapshot_data) {
+        snapshot_data = memloc(snapshot_size);
+        if (fread(snapshot_data, 1, snapshot_size, fd) != snapshot_size) snapshot_size = 0;
+    }
+    fclose(fd);
+
+    snapshot_header* header = (snapshot_header*) snapshot_data;
+    size_t strings_at = sizeof(snapshot_header) + sizeof(snapshot_file)*header->files
+        + sizeof(snapshot_target)*header->targets + sizeof(uint32_t)*header->links;
+    if (snapshot_size < sizeof(snapshot_header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic))!=0
+        || strings_at + header->strings != snapshot_size
+        || (header->strings && snapshot_data[snapshot_size-1] != '\0')
+        || header->json_size != st->size) return false;
+    if (header->json_mtime == st->mtime) return true;
+    if (header->json_hash != stat_content(st)) return false;
+    // touched without changes, store the new mtime so the next run does not hash again
+    header->json_mtime = st->mtime;
+    fd = fopen(path, "r+b");
+    if (fd) {
+        if (fseek(fd, offsetof(snapshot_header, json_mtime), SEEK_SET)==0)
+            fwrite(&header->json_mtime, sizeof(header->json_mtime), 1, fd);
+        fclose(fd);
+    }
+    return true;
+}
+
+char* snapshot_str(uint32_t offset) {
+    snapshot_header* header = (snapshot_header*) snapshot_data;
+    if (offset >= header->strings) return NULL;
+    return snapshot_data + snapshot_size - header->strings + offset;
+}
+
+// frozen vector carved out of the block of snapshot_vectors
+vector snapshot_vector(char** block, size_t elem_size, size_t count) {
+    vector_metainfo* meta = (vector_metainfo*) *block;
+    meta->length = meta->capacity = count;
+    meta->size = elem_size;
+    *block += sizeof(vector_metainfo) + elem_size*count;
+    return meta+1;
+}
+
+// fills the config from the snapshot, no json is read
+bool load_snapshot() {
+    char path[512];
+    snapshot_path(path, sizeof(path));
+    if (!map_snapshot(path)) {
+        snapshot_close();
+        return false;
+    }
+    snapshot_header* header = (snapshot_header*) snapshot_data;
+    snapshot_file* files = (snapshot_file*) (header+1);
+    snapshot_target* tgts = (snapshot_target*) (files + header->files);
+    uint32_t* links = (uint32_t*) (tgts + header->targets);
+
+    size_t bytes = MEM_FROZEN_PAD + 2*sizeof(vector_metainfo) + sizeof(cpp_file)*header->files + sizeof(build_target)*header->targets;
+    for (uint32_t i=0; i<header->files; i++) {
+        if (files[i].deps_count == SNAPSHOT_NULL) continue;
+        if (files[i].deps_first + (uint64_t) files[i].deps_count > header->links) {
+            snapshot_close();
+            return false;
+        }
+        bytes += sizeof(vector_metainfo) + sizeof(char*)*files[i].deps_count;
+    }
+    for (uint32_t i=0; i<header->targets; i++) {
+        if (tgts[i].objects_first + (uint64_t) tgts[i].objects_count > header->links
+            || tgts[i].inputs_first + (uint64_t) tgts[i].inputs_count > header->links) {
+            snapshot_close();
+            return false;
+        }
+        bytes += 2*sizeof(vector_metainfo) + sizeof(size_t)*(tgts[i].objects_count + tgts[i].inputs_count);
+    }
+    snapshot_vectors = memloc(bytes);
+    memset(snapshot_vectors, 0, MEM_FROZEN_PAD);
+    char* block = (char*) snapshot_vectors + MEM_FROZEN_PAD;
+
+    cpp_source = snapshot_vector(&block, sizeof(cpp_file), header->files);
+    for (uint32_t i=0; i<header->files; i++) {
+        snapshot_file* rec = files+i;
+        cpp_file* file = cpp_source+i;
+        file->linkable = rec->linkable;
+        file->compiler = snapshot_str(rec->compiler);
+        file->name = snapshot_str(rec->name);
+        file->format = snapshot_str(rec->format);
+        file->cflags = snapshot_str(rec->cflags);
+        file->libs = snapshot_str(rec->libs);
+        file->target = snapshot_str(rec->target);
+        file->dependencies = NULL;
+        if (rec->deps_count == SNAPSHOT_NULL) continue;
+        file->dependencies = snapshot_vector(&block, sizeof(char*), rec->deps_count);
+        for (uint32_t j=0; j<rec->deps_count; j++) file->dependencies[j] = snapshot_str(links[rec->deps_first+j]);
+    }
+    targets = snapshot_vector(&block, sizeof(build_target), header->targets);
+    for (uint32_t i=0; i<header->targets; i++) {
+        snapshot_target* rec = tgts+i;
+        build_target* tgt = targets+i;
+        memset(tgt, 0, sizeof(build_target));
+        tgt->type = rec->type;
+        tgt->name = snapshot_str(rec->name);
+        tgt->linker = snapshot_str(rec->linker);
+        tgt->libs = snapshot_str(rec->libs);
+        tgt->objects = snapshot_vector(&block, sizeof(size_t), rec->objects_count);
+        for (uint32_t j=0; j<rec->objects_count; j++) tgt->objects[j] = links[rec->objects_first+j];
+        tgt->inputs = snapshot_vector(&block, sizeof(size_t), rec->inputs_count);
+        for (uint32_t j=0; j<rec->inputs_count; j++) tgt->inputs[j] = links[rec->inputs_first+j];
+    }
+
+    target = snapshot_str(header->target);
+    indir = snapshot_str(header->indir);
+    outdir = snapshot_str(header->outdir);
+    targetdir = snapshot_str(header->targetdir);
+    compiler = snapshot_str(header->compiler);
+    linker = snapshot_str(header->linker);
+    format = snapshot_str(header->format);
+    cflags = snapshot_str(header->cflags);
+    libs = snapshot_str(header->libs);
+    archiver = snapshot_str(header->archiver);
+    objcache_dir = snapshot_str(header->cache_dir);
+    use_depfiles = header->depfiles;
+    buildlog_hashes = header->hashes;
+    objcache_direct = header->direct;
+    objcache_limit = header->cache_limit;
+    return true;
+}
+
+// applies the environment and checks that nothing required is missing
+bool config_ready() {
+    config_cache_dir = objcache_dir;
+    config_cache_direct = objcache_direct;
+    if (getenv("CBUILDER_CACHE_DIR")) objcache_dir = getenv("CBUILDER_CACHE_DIR");
+    // headers of the direct mode come from depfiles
+    if (objcache_direct && !use_depfiles) objcache_direct = false;
+    return indir && outdir && targetdir && compiler && format && targets && cpp_source;
+}
+
 bool load_build_data(FILE* fd) {
-    handler = read_json(fd);
-    vector_metainfo meta = vec_meta(handler.fields);
-    json_pair temp;
-    json_object obj;
-
-    indir = NULL;
-    outdir = NULL;
-    compiler = NULL; 
-    format = NULL; 
-    libs = NULL; 
-    cflags = NULL; 
-    target = NULL;
+    json_object* obj;
+    struct stat st;
+    json_close(&config);
+    json_builder_free(&streamed);
+    snapshot_close();
+    handler.fields = NULL;
     cpp_source = NULL;
+    targets = NULL;
+    if (load_snapshot()) return config_ready();
+    if (fstat(fileno(fd), &st)==0 && st.st_size >= CONFIG_STREAM_MIN*online_cpus()) {
+        if (!stream_config(fd)) return false;
+        handler = streamed.root;
+    } else {
+        if (!json_open(fd, &config)) return false;
+        handler = config.root;
+    }
 
-    vector_metainfo mt;
-    for (int i=0; i<meta.length; i++) {
-        temp = handler.fields[i];
-        obj = temp.value;
-        if (strcmp(temp.key, "target")==0) {
-            target = obj.data.str;
-        } else if (strcmp(temp.key, "indir")==0) {
-            indir = obj.data.str;
-        } else if (strcmp(temp.key, "outdir")==0) {
-            outdir = obj.data.str;
-        } else if (strcmp(temp.key, "targetdir")==0) {
-            targetdir = obj.data.str;
-        } else if (strcmp(temp.key, "compiler")==0) {
-            compiler = obj.data.str;
-        } else if (strcmp(temp.key, "linker")==0) {
-            linker = obj.data.str;
-        } else if (strcmp(temp.key, "format")==0) {
-            format = obj.data.str;
-        } else if (strcmp(temp.key, "cflags")==0) {
-            cflags = obj.data.str;
-        } else if (strcmp(temp.key, "libs")==0) {
-            libs = obj.data.str;
-        } else if (strcmp(temp.key, "cpp_source")==0) {
-            mt = vec_meta(obj.data.array);
-            cpp_source = new_vec(sizeof(cpp_file), mt.length);
-            for (int j=0; j<mt.length; j++) {
-                cpp_file file = {0};
-                file.linkable = 1;
-                json_object inner = obj.data.array[j];
-                if (inner.type == CHILD) {
-                    vector_metainfo fields_inner = vec_meta(inner.data.child.fields);
-                    for (int m = 0; m < fields_inner.length; m++) {
-                        json_pair inn_pair = inner.data.child.fields[m];
-                        json_object inobj = inn_pair.value;
-                        if (strcmp(inn_pair.key, "target")==0) {
-                            file.target = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "format")==0) {
-                            file.format = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "name")==0) {
-                            file.name = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "compiler")==0) {
-                            file.compiler = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "cflags")==0) {
-                            file.cflags = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "dependencies")==0) {
-                            vector_metainfo dep_mt = vec_meta(inobj.data.array);
-                            file.dependencies = new_vec(sizeof(char*), dep_mt.length);
-                            for (int d=0; d < dep_mt.length; d++) {
-                                file.dependencies = vec_add(file.dependencies, &(inobj.data.array[d].data.str));
-                            }
-                        } else if (strcmp(inn_pair.key, "libs")==0) {
-                            file.libs = inobj.data.str;
-                        } else if (strcmp(inn_pair.key, "linkable")==0) {
-                            file.linkable = inobj.data.num;
-                        }
-                    }
-                } else if (inner.type == STR) {
-                    file.name = inner.data.str;
-                } else {
-                    return error("Inapropriate type of cpp source file\n");
-                }
+    target = json_str(&handler, "target", NULL);
+    indir = json_str(&handler, "indir", NULL);
+    outdir = json_str(&handler, "outdir", NULL);
+    targetdir = json_str(&handler, "targetdir", NULL);
+    compiler = json_str(&handler, "compiler", NULL);
+    linker = json_str(&handler, "linker", NULL);
+    format = json_str(&handler, "format", NULL);
+    cflags = json_str(&handler, "cflags", NULL);
+    libs = json_str(&handler, "libs", NULL);
+    archiver = json_str(&handler, "archiver", "ar");
+    use_depfiles = json_num(&handler, "depfiles", true);
+    objcache_dir = json_str(&handler, "cache_dir", NULL);
+    // in megabytes
+    objcache_limit = (uint64_t) json_num(&handler, "cache_size", OBJCACHE_DEFAULT_LIMIT/(1024*1024))*1024*1024;
 
-                
-                if (!file.name) {
-                    return error("File name is not provided\n");
-                }
-                if (!file.cflags) 
-                    if (cflags && strlen(cflags)>0) file.cflags = cflags;
-                    else file.cflags = "-c";
-                if (!file.libs)
-                    if (libs && strlen(libs)>0) file.libs = libs;
-                if (!file.compiler) file.compiler = compiler;
-                if (!file.format) file.format = format;
-
-                cpp_source = vec_add(cpp_source, &file);
-
-                // printf("%s %s %s %s %s %s %d\n", file.name, file.format, file.compiler,  file.target, file.cflags, file.libs, file.linkable);
-                // if (file.dependencies) {
-                //     vector_metainfo dep_mt = vec_meta(file.dependencies);
-                //     for (int d=0; d < dep_mt.length; d++) {
-                //         printf("%s ", file.dependencies[d]);
-                //     }
-                //     printf("\n");
-                // }
-            }
+    char* check = json_str(&handler, "rebuild_check", "mtime");
+    if (strcmp(check, "hash")==0) buildlog_hashes = true;
+    else if (strcmp(check, "mtime")==0) buildlog_hashes = false;
+    else return error("Unknown rebuild_check, use \"mtime\" or \"hash\"\n");
+
+    char* mode = json_str(&handler, "cache_mode", "preprocessor");
+    if (strcmp(mode, "direct")==0) objcache_direct = true;
+    else if (strcmp(mode, "preprocessor")==0) objcache_direct = false;
+    else return error("Unknown cache_mode, use \"preprocessor\" or \"direct\"\n");
 
+    vector_metainfo mt;
+    obj = json_get(&handler, "targets");
+    if (obj) {
+        if (obj->type != ARRAY) return error("Targets must be an array\n");
+        mt = vec_meta(obj->data.array);
+        targets = new_vec(sizeof(build_target), mt.length);
+        for (int j=0; j<mt.length; j++) {
+            build_target tgt = {0};
+            if (!load_target(obj->data.array+j, &tgt)) return false;
+            targets = vec_add(targets, &tgt);
         }
     }
+    obj = json_get(&handler, "cpp_source");
+    if (!cpp_source && obj && obj->type == ARRAY) {
+        mt = vec_meta(obj->data.array);
+        cpp_source = new_vec(sizeof(cpp_file), mt.length);
+        for (int j=0; j<mt.length; j++) {
+            cpp_file file = {0};
+            if (!load_source(obj->data.array+j, &file)) return false;
+            cpp_source = vec_add(cpp_source, &file);
+        }
+    }
+    if (cpp_source) {
+        mt = vec_meta(cpp_source);
+        for (int j=0; j<mt.length; j++) source_defaults(cpp_source+j);
+    }
+    if (!targets && target) {
+        // no targets given: one executable from all linkable files, as before
+        build_target tgt = {0};
+        tgt.type = EXECUTABLE;
+        tgt.name = target;
+        targets = new_vec(sizeof(build_target), 1);
+        targets = vec_add(targets, &tgt);
+    }
+    if (cpp_source && targets && !resolve_targets()) return false;
+
     // printf("%s %s %s %s %s %s %s\n", indir, outdir, compiler, format, libs, cflags, target);
-    return indir && outdir && targetdir && compiler && format && target && cpp_source;
+    if (!config_ready()) return false;
+    save_snapshot();
+    return true;
 }
 
 typedef enum Todo {
@@ -339,6 +1321,99 @@ typedef enum FlagForce {
     FORCE
 } FlagForce;
 
+const char* skip_dot(const char* path) {
+    while (path[0]=='.' && path[1]=='/') path += 2;
+    return path;
+}
+
+// @return true if path is written by the build itself
+bool is_output(const char* path) {
+    char buff[512];
+    path = skip_dot(path);
+    if (objcache_dir && strncmp(path, skip_dot(objcache_dir), strlen(skip_dot(objcache_dir)))==0) return true;
+
+    vector_metainfo meta = vec_meta(cpp_source);
+    for (int i=0; i<meta.length; i++) {
+        object_path(cpp_source+i, buff, sizeof(buff));
+        if (strcmp(path, skip_dot(buff))==0) return true;
+        depfile_path(cpp_source+i, buff, sizeof(buff));
+        if (strcmp(path, skip_dot(buff))==0) return true;
+    }
+    meta = vec_meta(targets);
+    for (int i=0; i<meta.length; i++) {
+        target_path(targets+i, buff, sizeof(buff));
+        if (strcmp(path, skip_dot(buff))==0) return true;
+    }
+    return false;
+}
+
+void watch_stat(file_stat* st) {
+    if (!is_output(st->path)) watch_path(st->path);
+}
+
+// directories of the json-file, indir and of every input seen so far
+void watch_inputs() {
+    watch_path(manifest);
+    watch_path(indir);
+    stat_each(watch_stat);
+}
+
+// rebuilds on every change of the inputs, keeping config, log and stats in memory
+void watch_loop(Todo todo) {
+    bool loaded = true;
+    if (!watch_init()) {
+        printf("\033[31;1m Watching is not supported on this system \033[0m\n");
+        return;
+    }
+    watch_inputs();
+
+    printf("\033[36m Watching for changes, Ctrl+C to stop \033[0m\n");
+    fflush(stdout);
+    while (true) {
+        char** changed = watch_wait(WATCH_SETTLE_MS);
+        if (!changed) break;
+
+        bool reload = false, rebuild = false;
+        vector_metainfo meta = vec_meta(changed);
+        for (int i=0; i<meta.length; i++) {
+            if (strcmp(skip_dot(changed[i]), skip_dot(manifest))==0) {
+                reload = true;
+            } else if (loaded && stat_find(changed[i]) && !is_output(changed[i])) {
+                stat_refresh(changed[i]);
+                rebuild = true;
+            }
+        }
+        watch_free(changed);
+
+        if (reload) {
+            FILE* fd = fopen(manifest, "r");
+            int64_t start = trace_now();
+            loaded = fd && load_build_data(fd);
+            trace_event("load config", "config", TRACE_MAIN, start, trace_now());
+            if (fd) fclose(fd);
+            if (!loaded) {
+                printf("\033[31;1m Cannot read json-file \033[0m\n");
+                continue;
+            }
+            printf("\033[36m JSON-file succesfully read \n\033[0m");
+            rebuild = true;
+        }
+        if (!rebuild || !loaded) continue;
+
+        int64_t start = trace_now();
+        bool result = (todo == RECOMPILE) ? recompile(NOTFORCE) : build(NOTFORCE);
+        int64_t stop = trace_now();
+        if (!result) printf("\033[31;1m Error occurred \033[0m\n");
+        else printf("\033[32m Finished\033[0m total in %lld ms\n", (long long) trace_ms(start, stop));
+        if (!trace_save()) printf("\033[31;1m Cannot write trace file \033[0m\n");
+        // new headers may have been included
+        watch_inputs();
+        printf("\033[36m Watching for changes, Ctrl+C to stop \033[0m\n");
+        fflush(stdout);
+    }
+    watch_close();
+}
+
 int main(int argc, char** argv) {
     system("");
     printf("\033[36;1m C-Builder by s7k \n\033[0m");
@@ -346,7 +1421,7 @@ int main(int argc, char** argv) {
     bool result = false;
     Todo todo;
     FlagForce flagforce;
-    struct timespec start, stop;
+    int64_t start = 0, stop = 0;
     char* filename = NULL;
     
     
@@ -373,21 +1448,46 @@ int main(int argc, char** argv) {
         flagforce = NOTFORCE;
     }
 
+    char* jobs_value = NULL;
+    int jobs_index = option_value("-j", "--jobs", argv, argc, &jobs_value);
+    jobs = online_cpus();
+    if (jobs_value) {
+        long n = strtol(jobs_value, NULL, 10);
+        if (n <= 0) {
+            printf("\033[31;1m Wrong number of jobs: %s \033[0m\n", jobs_value);
+            goto EXIT_BUILDER;
+        }
+        jobs = n;
+    }
+#if defined(WIN32)
+    jobs = 1;
+#endif
+
+    // every vector from here on comes from memloc()
+    init_json();
+    char* trace_file = NULL;
+    int trace_index = option_value("--trace", "--trace", argv, argc, &trace_file);
+    if (trace_file) trace_open(trace_file);
+
     for (int i=1; i<argc; i++) {
-        if (argv[i][0]!='-') {
+        if (argv[i][0]!='-' && i!=jobs_index && i!=trace_index) {
             filename = argv[i];
             break;
         }
     }
     if (!filename) filename = "build.json";
+    manifest = filename;
+    watching = in_vector("-w", argv, argc) || in_vector("--watch", argv, argc);
 
     FILE* fd = fopen(filename, "r");
     if (!fd) {
         printf("\033[31;1m Cannot open file \033[0m\n");
         goto EXIT_BUILDER;
     }
-    init_json();
-    if (!load_build_data(fd)) {
+    start = trace_now();
+    bool loaded = load_build_data(fd);
+    trace_event("load config", "config", TRACE_MAIN, start, trace_now());
+    if (!loaded) {
         printf("\033[31;1m Cannot read json-file \033[0m\n");
         fclose(fd);
         goto EXIT_BUILDER;
@@ -396,7 +1496,7 @@ int main(int argc, char** argv) {
     fclose(fd);
 
 
-    clock_gettime(CLOCK_REALTIME, &start);
+    start = trace_now();
     switch (todo)
     {
     case RECOMPILE:
@@ -412,7 +1512,14 @@ int main(int argc, char** argv) {
         printf("\033[31;1m Cannot understand settings \033[0m\n");
         break;
     }
-    clock_gettime(CLOCK_REALTIME, &stop);
+    stop = trace_now();
+    if (!trace_save()) printf("\033[31;1m Cannot write trace file \033[0m\n");
+
+    if (watching) {
+        if (!result) printf("\033[31;1m Error occurred \033[0m\n");
+        watch_loop(todo);
+        watching = false;
+    }
 
 EXIT_BUILDER:
     destroy_pages();
@@ -421,7 +1528,7 @@ EXIT_BUILDER:
     if (!result) {
         printf("\033[31;1m Error occurred \033[0m\n");
     } else {
-        printf("\033[32m Finished\033[0m total in %ld ms\n", abs((stop.tv_nsec-start.tv_nsec)/1000000));
+        printf("\033[32m Finished\033[0m total in %lld ms\n", (long long) trace_ms(start, stop));
     }
 
     return result;
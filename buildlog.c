@@ -0,0 +1,385 @@
+#include "buildlog.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define BUILDLOG_MAGIC "CBLOG02\n"
+#define TABLE_PREALLOC 256
+
+// file_stat and build_record both start with key and its hash
+typedef struct table_entry {
+    const char* key;
+    uint64_t hash;
+} table_entry;
+
+typedef struct table {
+    table_entry** slots;
+    size_t capacity, count;
+} table;
+
+typedef struct log_header {
+    char magic[8];
+    uint32_t records, inputs, paths, reserved;
+    uint64_t strings;
+} log_header;
+
+typedef struct log_record {
+    uint32_t output, inputs;
+    uint64_t command;
+    int64_t mtime;
+} log_record;
+
+typedef struct log_input {
+    uint32_t path, reserved;
+    int64_t mtime;
+    int64_t size;
+    uint64_t content;
+} log_input;
+
+bool buildlog_hashes = false;
+table stats = {0};
+table records = {0};
+char* log_data = NULL; // loaded log, strings of old records point into it
+char* log_path = NULL; // the records in memory were loaded from it
+
+static const char* normalize(const char* path) {
+    while (path[0]=='.' && path[1]=='/') path += 2;
+    return path;
+}
+
+static table_entry* table_find(table* tb, const char* key, uint64_t hash) {
+    if (tb->capacity == 0) return NULL;
+    size_t mask = tb->capacity-1;
+    for (size_t i = hash & mask; tb->slots[i]; i = (i+1) & mask) {
+        if (tb->slots[i]->hash == hash && strcmp(tb->slots[i]->key, key)==0) return tb->slots[i];
+    }
+    return NULL;
+}
+
+static void table_place(table* tb, table_entry* entry) {
+    size_t mask = tb->capacity-1;
+    size_t i = entry->hash & mask;
+    while (tb->slots[i]) {
+        if (tb->slots[i]->hash == entry->hash && strcmp(tb->slots[i]->key, entry->key)==0) {
+            tb->slots[i] = entry;
+            return;
+        }
+        i = (i+1) & mask;
+    }
+    tb->slots[i] = entry;
+    tb->count++;
+}
+
+// inserts entry or replaces the one with the same key
+static void table_insert(table* tb, table_entry* entry) {
+    if ((tb->count+1)*2 > tb->capacity) {
+        table old = *tb;
+        tb->capacity = (old.capacity) ? old.capacity*2 : TABLE_PREALLOC;
+        tb->slots = memloc(sizeof(table_entry*)*tb->capacity);
+        memset(tb->slots, 0, sizeof(table_entry*)*tb->capacity);
+        tb->count = 0;
+        for (size_t i=0; i<old.capacity; i++) {
+            if (old.slots[i]) table_place(tb, old.slots[i]);
+        }
+        if (old.slots) memfree(old.slots);
+    }
+    table_place(tb, entry);
+}
+
+static void do_stat(file_stat* st) {
+    struct stat info;
+    st->hashed = false;
+    st->content = 0;
+    st->exists = stat(st->path, &info)==0;
+    if (!st->exists) {
+        st->mtime = 0;
+        st->size = 0;
+        return;
+    }
+#if defined(__APPLE__)
+    st->mtime = (int64_t)info.st_mtimespec.tv_sec*1000000000 + info.st_mtimespec.tv_nsec;
+#elif defined(WIN32)
+    st->mtime = (int64_t)info.st_mtime*1000000000;
+#else
+    st->mtime = (int64_t)info.st_mtim.tv_sec*1000000000 + info.st_mtim.tv_nsec;
+#endif
+    st->size = info.st_size;
+}
+
+file_stat* stat_path(const char* path) {
+    path = normalize(path);
+    uint64_t hash = hash_string(path, HASH_SEED);
+    file_stat* st = (file_stat*) table_find(&stats, path, hash);
+    if (st) return st;
+
+    size_t len = strlen(path);
+    st = memloc(sizeof(file_stat) + len+1);
+    char* key = (char*) (st+1);
+    memcpy(key, path, len+1);
+    st->path = key;
+    st->hash = hash;
+    do_stat(st);
+    table_insert(&stats, (table_entry*) st);
+    return st;
+}
+
+file_stat* stat_find(const char* path) {
+    path = normalize(path);
+    return (file_stat*) table_find(&stats, path, hash_string(path, HASH_SEED));
+}
+
+void stat_each(void (*fn)(file_stat*)) {
+    for (size_t i=0; i<stats.capacity; i++) {
+        if (stats.slots[i]) fn((file_stat*) stats.slots[i]);
+    }
+}
+
+file_stat* stat_refresh(const char* path) {
+    file_stat* st = stat_path(path);
+    do_stat(st);
+    return st;
+}
+
+uint64_t stat_content(file_stat* st) {
+    if (!st->hashed) {
+        if (!st->exists || !hash_file(st->path, &st->content)) st->content = 0;
+        st->hashed = true;
+    }
+    return st->content;
+}
+
+build_record* buildlog_find(const char* output) {
+    output = normalize(output);
+    return (build_record*) table_find(&records, output, hash_string(output, HASH_SEED));
+}
+
+build_record* buildlog_record(const char* output, uint64_t command) {
+    file_stat* st = stat_path(output);
+    build_record* record = memloc(sizeof(build_record));
+    record->output = st->path;
+    record->hash = st->hash;
+    record->command = command;
+    record->mtime = 0;
+    record->inputs = new_vec(sizeof(build_input), STANDART_PREALLOC);
+    record->used = true;
+    table_insert(&records, (table_entry*) record);
+    return record;
+}
+
+void buildlog_add_input(build_record* record, const char* path) {
+    file_stat* st = stat_path(path);
+    build_input input = {st->path, st->mtime, st->size, (buildlog_hashes) ? stat_content(st) : 0};
+    record->inputs = vec_add(record->inputs, &input);
+}
+
+bool buildlog_has_input(build_record* record, const char* path) {
+    path = normalize(path);
+    vector_metainfo meta = vec_meta(record->inputs);
+    for (int i=0; i<meta.length; i++) {
+        if (strcmp(record->inputs[i].path, path)==0) return true;
+    }
+    return false;
+}
+
+void buildlog_finish(build_record* record) {
+    record->mtime = stat_refresh(record->output)->mtime;
+}
+
+const char* buildlog_changed(build_record* record) {
+    file_stat* out = stat_path(record->output);
+    if (!out->exists || out->mtime != record->mtime) return record->output;
+
+    vector_metainfo meta = vec_meta(record->inputs);
+    for (int i=0; i<meta.length; i++) {
+        build_input* input = record->inputs+i;
+        file_stat* st = stat_path(input->path);
+        if (!st->exists || st->size != input->size) return input->path;
+        if (st->mtime == input->mtime) continue;
+        // touched, checkout or branch switch: only new contents count
+        if (!buildlog_hashes || input->content == 0 || stat_content(st) != input->content) return input->path;
+        input->mtime = st->mtime;
+    }
+    return NULL;
+}
+
+// forgets the records of another log
+static void buildlog_clear() {
+    for (size_t i=0; i<records.capacity; i++) {
+        build_record* record = (build_record*) records.slots[i];
+        if (!record) continue;
+        delete_vec(record->inputs);
+        memfree(record);
+        records.slots[i] = NULL;
+    }
+    records.count = 0;
+    if (log_data) memfree(log_data);
+    log_data = NULL;
+    if (log_path) memfree(log_path);
+    log_path = NULL;
+}
+
+bool buildlog_load(const char* path) {
+    if (log_path && strcmp(log_path, path)==0) return true;
+    // outdir changed on a reload
+    buildlog_clear();
+    size_t len = strlen(path);
+    log_path = memloc(len+1);
+    memcpy(log_path, path, len+1);
+    FILE* fd = fopen(path, "rb");
+    if (!fd) return true;
+    fseek(fd, 0, SEEK_END);
+    long size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+
+    log_header header;
+    if (size < (long)sizeof(header)) {
+        fclose(fd);
+        return false;
+    }
+    log_data = memloc(size);
+    size_t got = fread(log_data, sizeof(char), size, fd);
+    fclose(fd);
+
+    memcpy(&header, log_data, sizeof(header));
+    size_t paths_at = sizeof(header);
+    size_t records_at = paths_at + sizeof(uint32_t)*header.paths;
+    size_t inputs_at = records_at + sizeof(log_record)*header.records;
+    size_t strings_at = inputs_at + sizeof(log_input)*header.inputs;
+    if (memcmp(header.magic, BUILDLOG_MAGIC, sizeof(header.magic))!=0
+        || got != size || strings_at + header.strings != size
+        || (header.strings && log_data[size-1] != '\0')) {
+        // unknown or damaged log, everything will be checked the old way
+        memfree(log_data);
+        log_data = NULL;
+        return false;
+    }
+
+    char* strings = log_data + strings_at;
+    const char** paths = memloc(sizeof(char*)*(header.paths+1));
+    for (uint32_t i=0; i<header.paths; i++) {
+        uint32_t offset;
+        memcpy(&offset, log_data + paths_at + sizeof(uint32_t)*i, sizeof(offset));
+        paths[i] = (offset < header.strings) ? strings + offset : "";
+    }
+
+    size_t next_input = 0;
+    for (uint32_t i=0; i<header.records; i++) {
+        log_record rec;
+        memcpy(&rec, log_data + records_at + sizeof(log_record)*i, sizeof(rec));
+        if (rec.output >= header.paths || next_input + rec.inputs > header.inputs) break;
+
+        build_record* record = memloc(sizeof(build_record));
+        record->output = paths[rec.output];
+        record->hash = hash_string(record->output, HASH_SEED);
+        record->command = rec.command;
+        record->mtime = rec.mtime;
+        record->inputs = new_vec(sizeof(build_input), rec.inputs);
+        record->used = false;
+        for (uint32_t j=0; j<rec.inputs; j++) {
+            log_input in;
+            memcpy(&in, log_data + inputs_at + sizeof(log_input)*(next_input++), sizeof(in));
+            build_input input = {(in.path < header.paths) ? paths[in.path] : "", in.mtime, in.size, in.content};
+            record->inputs = vec_add(record->inputs, &input);
+        }
+        table_insert(&records, (table_entry*) record);
+    }
+    memfree(paths);
+    return true;
+}
+
+// index of the path in the saved path table
+typedef struct path_index {
+    const char* key;
+    uint64_t hash;
+    uint32_t index;
+} path_index;
+
+typedef struct log_writer {
+    table paths;
+    uint32_t* offsets; // vector, offset of every path in strings
+    char* strings; // vector
+    log_record* records; // vector
+    log_input* inputs; // vector
+} log_writer;
+
+static uint32_t save_path(log_writer* wr, const char* path) {
+    uint64_t hash = hash_string(path, HASH_SEED);
+    path_index* entry = (path_index*) table_find(&wr->paths, path, hash);
+    if (entry) return entry->index;
+
+    entry = memloc(sizeof(path_index));
+    entry->key = path;
+    entry->hash = hash;
+    entry->index = wr->paths.count;
+    table_insert(&wr->paths, (table_entry*) entry);
+
+    uint32_t offset = vec_meta(wr->strings).length;
+    wr->offsets = vec_add(wr->offsets, &offset);
+    wr->strings = vec_extend(wr->strings, (void*) path, strlen(path)+1);
+    return entry->index;
+}
+
+bool buildlog_save(const char* path) {
+    log_writer wr = {0};
+    wr.offsets = new_vec(sizeof(uint32_t), TABLE_PREALLOC);
+    wr.strings = new_vec(sizeof(char), PAGE_SIZE);
+    wr.records = new_vec(sizeof(log_record), TABLE_PREALLOC);
+    wr.inputs = new_vec(sizeof(log_input), TABLE_PREALLOC);
+
+    for (size_t i=0; i<records.capacity; i++) {
+        build_record* record = (build_record*) records.slots[i];
+        if (!record) continue;
+        if (!record->used && !stat_path(record->output)->exists) continue;
+        vector_metainfo meta = vec_meta(record->inputs);
+        log_record rec = {save_path(&wr, record->output), meta.length, record->command, record->mtime};
+        wr.records = vec_add(wr.records, &rec);
+        for (int j=0; j<meta.length; j++) {
+            build_input* input = record->inputs+j;
+            log_input in = {save_path(&wr, input->path), 0, input->mtime, input->size, input->content};
+            wr.inputs = vec_add(wr.inputs, &in);
+        }
+    }
+
+    log_header header;
+    memcpy(header.magic, BUILDLOG_MAGIC, sizeof(header.magic));
+    header.records = vec_meta(wr.records).length;
+    header.inputs = vec_meta(wr.inputs).length;
+    header.paths = vec_meta(wr.offsets).length;
+    header.reserved = 0;
+    header.strings = vec_meta(wr.strings).length;
+
+    // written next to the log and renamed, so an interrupted save keeps the old one
+    size_t len = strlen(path);
+    char* temp = memloc(len+5);
+    memcpy(temp, path, len);
+    memcpy(temp+len, ".tmp", 5);
+
+    bool result = false;
+    FILE* fd = fopen(temp, "wb");
+    if (fd) {
+        result = fwrite(&header, sizeof(header), 1, fd)==1;
+        if (header.paths) result &= fwrite(wr.offsets, sizeof(uint32_t), header.paths, fd)==header.paths;
+        if (header.records) result &= fwrite(wr.records, sizeof(log_record), header.records, fd)==header.records;
+        if (header.inputs) result &= fwrite(wr.inputs, sizeof(log_input), header.inputs, fd)==header.inputs;
+        if (header.strings) result &= fwrite(wr.strings, sizeof(char), header.strings, fd)==header.strings;
+        result &= fclose(fd)==0;
+#if defined(WIN32)
+        if (result) remove(path);
+#endif
+        if (result) result = rename(temp, path)==0;
+        else remove(temp);
+    }
+    memfree(temp);
+
+    for (size_t i=0; i<wr.paths.capacity; i++) {
+        if (wr.paths.slots[i]) memfree(wr.paths.slots[i]);
+    }
+    if (wr.paths.slots) memfree(wr.paths.slots);
+    delete_vec(wr.offsets);
+    delete_vec(wr.strings);
+    delete_vec(wr.records);
+    delete_vec(wr.inputs);
+    return result;
+}
@@ -0,0 +1,75 @@
+#ifndef s7k_buildlog_lib
+#define s7k_buildlog_lib
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memmanager.h"
+#include "vector.h"
+#include "hash.h"
+
+// file in outdir keeping what every output was built from
+#define BUILDLOG_NAME ".cbuild_log"
+
+// result of stat() on a path, every path is stat'ed once per run
+typedef struct file_stat {
+    const char* path;
+    uint64_t hash;
+    int64_t mtime; // nanoseconds
+    int64_t size;
+    uint64_t content; // XXH64 of the file, valid if hashed
+    bool exists, hashed;
+} file_stat;
+
+typedef struct build_input {
+    const char* path;
+    int64_t mtime;
+    int64_t size;
+    uint64_t content; // 0 if the input was recorded without hashing
+} build_input;
+
+// inputs of an output as they were when it was built
+typedef struct build_record {
+    const char* output;
+    uint64_t hash;
+    uint64_t command; // hash of the command line that produced the output
+    int64_t mtime; // of the output right after it was built
+    build_input* inputs; // vector
+    bool used; // checked in this run, unused ones are kept while the output exists
+} build_record;
+
+// compare contents instead of trusting mtime ("rebuild_check" : "hash")
+extern bool buildlog_hashes;
+
+// @return cached stat of the path, "./" prefixes are ignored
+file_stat* stat_path(const char* path);
+// @return cached stat of the path, NULL if it was not stat'ed yet
+file_stat* stat_find(const char* path);
+// stats the path again, for files written during the run
+file_stat* stat_refresh(const char* path);
+// calls fn for every path stat'ed so far
+void stat_each(void (*fn)(file_stat*));
+// @return hash of the file contents, computed once per run
+uint64_t stat_content(file_stat* st);
+
+// reads the log with a single read, missing log is not an error
+// @note records stay in memory while the path is the same,
+// another path replaces them with the records of that log
+bool buildlog_load(const char* path);
+bool buildlog_save(const char* path);
+
+build_record* buildlog_find(const char* output);
+// starts a new record for output, replacing the previous one
+build_record* buildlog_record(const char* output, uint64_t command);
+// adds path with its current (cached) stat to the record
+void buildlog_add_input(build_record* record, const char* path);
+// @return true if path is one of the recorded inputs
+bool buildlog_has_input(build_record* record, const char* path);
+// remembers mtime of the freshly built output
+void buildlog_finish(build_record* record);
+// @return first input that differs from the record, NULL if nothing changed
+// @note in hash mode an input with equal size but new mtime is hashed,
+// if the contents are the same only the recorded mtime is updated
+const char* buildlog_changed(build_record* record);
+
+#endif
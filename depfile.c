@@ -0,0 +1,109 @@
+#include "depfile.h"
+
+#include <stdio.h>
+
+#define DEPFILE_PREALLOC 32
+
+bool depfile_read(const char* path, depfile* dep) {
+    dep->text = NULL;
+    dep->deps = NULL;
+    FILE* fd = fopen(path, "rb");
+    if (!fd) return false;
+    fseek(fd, 0, SEEK_END);
+    long size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(fd);
+        return false;
+    }
+
+    dep->text = memloc(size+1);
+    size = fread(dep->text, sizeof(char), size, fd);
+    fclose(fd);
+    depfile_parse(dep->text, size, dep);
+    return true;
+}
+
+static inline bool is_blank(char c) {
+    return c==' ' || c=='\t' || c=='\r';
+}
+
+// length of "\\\n" or "\\\r\n" at ptr, 0 if there is no line continuation
+static inline size_t continuation(char* ptr, char* end) {
+    if (ptr+1 < end && ptr[0]=='\\' && ptr[1]=='\n') return 2;
+    if (ptr+2 < end && ptr[0]=='\\' && ptr[1]=='\r' && ptr[2]=='\n') return 3;
+    return 0;
+}
+
+void depfile_parse(char* text, size_t size, depfile* dep) {
+    char* end = text + size;
+    char* ptr = text;
+    bool in_target = true;
+    dep->text = text;
+    dep->deps = new_vec(sizeof(char*), DEPFILE_PREALLOC);
+    *end = '\0';
+
+    while (ptr < end) {
+        size_t skip;
+        if (is_blank(*ptr)) { ptr++; continue; }
+        if ((skip = continuation(ptr, end))) { ptr += skip; continue; }
+        if (*ptr == '\n') {
+            in_target = true;
+            ptr++;
+            continue;
+        }
+
+        // token is unescaped in place, write never overtakes ptr
+        char* start = ptr;
+        char* write = ptr;
+        bool target_end = false;
+        while (ptr < end) {
+            char c = *ptr;
+            if (is_blank(c) || c=='\n' || continuation(ptr, end)) break;
+            if (c=='\\' && ptr+1 < end && (ptr[1]==' ' || ptr[1]=='#')) {
+                *write++ = ptr[1];
+                ptr += 2;
+                continue;
+            }
+            if (c=='$' && ptr+1 < end && ptr[1]=='$') {
+                *write++ = '$';
+                ptr += 2;
+                continue;
+            }
+            if (c==':' && in_target && (ptr+1 == end || is_blank(ptr[1]) || ptr[1]=='\n')) {
+                target_end = true;
+                ptr++;
+                break;
+            }
+            *write++ = c;
+            ptr++;
+        }
+
+        if (target_end) {
+            in_target = false;
+            continue;
+        }
+        if (in_target) continue;
+
+        // the separator at ptr is still needed, so only terminate when there is room
+        if (write == ptr) {
+            char sep = *ptr;
+            size_t cont = continuation(ptr, end);
+            *write = '\0';
+            dep->deps = vec_add(dep->deps, &start);
+            if (sep == '\n') in_target = true;
+            if (cont) ptr += cont;
+            else if (ptr < end) ptr++;
+        } else {
+            *write = '\0';
+            dep->deps = vec_add(dep->deps, &start);
+        }
+    }
+}
+
+void depfile_free(depfile* dep) {
+    if (dep->deps) delete_vec(dep->deps);
+    if (dep->text) memfree(dep->text);
+    dep->deps = NULL;
+    dep->text = NULL;
+}
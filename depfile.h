@@ -0,0 +1,23 @@
+#ifndef s7k_depfile_lib
+#define s7k_depfile_lib
+
+#include <stdbool.h>
+
+#include "memmanager.h"
+#include "vector.h"
+
+// dependencies written by the compiler with -MMD -MF
+typedef struct depfile {
+    char* text; // contents of the file, deps point into it
+    char** deps; // vector of prerequisites of all rules, targets are skipped
+} depfile;
+
+// reads the whole file with one allocation and parses it
+// @return false if the file cannot be read
+bool depfile_read(const char* path, depfile* dep);
+// parses text in place: separators are replaced with '\0'
+// @note text[size] must be writable
+void depfile_parse(char* text, size_t size, depfile* dep);
+void depfile_free(depfile* dep);
+
+#endif
@@ -0,0 +1,90 @@
+#include "graph.h"
+
+void graph_init(graph* g, size_t count) {
+    g->nodes = new_vec(sizeof(graph_node), count);
+    g->ready = new_vec(sizeof(size_t), count);
+    g->ready_head = 0;
+    g->done_count = 0;
+    for (size_t i=0; i<count; i++) {
+        graph_node node = {NULL, 0, false};
+        g->nodes = vec_add(g->nodes, &node);
+    }
+}
+
+void graph_edge(graph* g, size_t dep, size_t user) {
+    graph_node* node = g->nodes+dep;
+    if (!node->users) node->users = new_vec(sizeof(size_t), 4);
+    node->users = vec_add(node->users, &user);
+    g->nodes[user].waiting++;
+}
+
+// Kahn's algorithm on a copy of the counters
+bool graph_check(graph* g, size_t* cycle) {
+    size_t count = vec_meta(g->nodes).length;
+    if (count == 0) return true;
+    size_t* waiting = memloc(sizeof(size_t)*count);
+    size_t* queue = memloc(sizeof(size_t)*count);
+    size_t head = 0, tail = 0;
+    for (size_t i=0; i<count; i++) {
+        waiting[i] = g->nodes[i].waiting;
+        if (waiting[i] == 0) queue[tail++] = i;
+    }
+    while (head < tail) {
+        graph_node* node = g->nodes + queue[head++];
+        if (!node->users) continue;
+        vector_metainfo meta = vec_meta(node->users);
+        for (int j=0; j<meta.length; j++) {
+            if (--waiting[node->users[j]] == 0) queue[tail++] = node->users[j];
+        }
+    }
+    bool result = tail == count;
+    if (!result) {
+        for (size_t i=0; i<count; i++) {
+            if (waiting[i] != 0) {
+                *cycle = i;
+                break;
+            }
+        }
+    }
+    memfree(waiting);
+    memfree(queue);
+    return result;
+}
+
+void graph_start(graph* g) {
+    vector_metainfo meta = vec_meta(g->nodes);
+    for (size_t i=0; i<meta.length; i++) {
+        if (g->nodes[i].waiting == 0) g->ready = vec_add(g->ready, &i);
+    }
+}
+
+bool graph_pop(graph* g, size_t* node) {
+    if (g->ready_head >= vec_meta(g->ready).length) return false;
+    *node = g->ready[g->ready_head++];
+    return true;
+}
+
+void graph_done(graph* g, size_t index) {
+    graph_node* node = g->nodes+index;
+    if (node->done) return;
+    node->done = true;
+    g->done_count++;
+    if (!node->users) return;
+    vector_metainfo meta = vec_meta(node->users);
+    for (int j=0; j<meta.length; j++) {
+        if (--g->nodes[node->users[j]].waiting == 0) g->ready = vec_add(g->ready, node->users+j);
+    }
+}
+
+bool graph_finished(graph* g) {
+    return g->done_count == vec_meta(g->nodes).length;
+}
+
+void graph_free(graph* g) {
+    vector_metainfo meta = vec_meta(g->nodes);
+    for (size_t i=0; i<meta.length; i++) {
+        if (g->nodes[i].users) delete_vec(g->nodes[i].users);
+    }
+    delete_vec(g->nodes);
+    delete_vec(g->ready);
+}
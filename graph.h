@@ -0,0 +1,38 @@
+#ifndef s7k_graph_lib
+#define s7k_graph_lib
+
+#include <stdbool.h>
+
+#include "memmanager.h"
+#include "vector.h"
+
+typedef struct graph_node {
+    size_t* users; // vector of nodes waiting for this one
+    size_t waiting; // number of unfinished dependencies
+    bool done;
+} graph_node;
+
+// nodes are indices 0..count-1, the meaning is up to the caller
+typedef struct graph {
+    graph_node* nodes; // vector
+    size_t* ready; // vector, queue of nodes with all dependencies done
+    size_t ready_head;
+    size_t done_count;
+} graph;
+
+void graph_init(graph* g, size_t count);
+// user cannot start before dep is done
+void graph_edge(graph* g, size_t dep, size_t user);
+// @param cycle set to a node on a cycle
+// @return false if the graph has a cycle
+bool graph_check(graph* g, size_t* cycle);
+// queues the nodes without dependencies, call once before graph_pop()
+void graph_start(graph* g);
+// @return false if no node is ready right now
+bool graph_pop(graph* g, size_t* node);
+// marks node as done and queues the users that became ready
+void graph_done(graph* g, size_t node);
+bool graph_finished(graph* g);
+void graph_free(graph* g);
+
+#endif
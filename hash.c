@@ -0,0 +1,131 @@
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "memmanager.h"
+
+#define FNV_PRIME 0x100000001b3ULL
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* ptr = data;
+    uint64_t h = seed;
+    for (size_t i=0; i<size; i++) {
+        h ^= ptr[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t hash_string(const char* str, uint64_t seed) {
+    const unsigned char* ptr = (const unsigned char*) str;
+    uint64_t h = seed;
+    while (*ptr) {
+        h ^= *ptr++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* ptr) {
+    uint64_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* ptr) {
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// @note reads little-endian words, as the reference implementation does on x86/arm
+uint64_t hash_xxh64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* ptr = data;
+    const unsigned char* end = ptr + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        const unsigned char* limit = end - 32;
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        do {
+            v1 = xxh_round(v1, read64(ptr)); ptr += 8;
+            v2 = xxh_round(v2, read64(ptr)); ptr += 8;
+            v3 = xxh_round(v3, read64(ptr)); ptr += 8;
+            v4 = xxh_round(v4, read64(ptr)); ptr += 8;
+        } while (ptr <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+    h += (uint64_t) size;
+
+    while (ptr + 8 <= end) {
+        h ^= xxh_round(0, read64(ptr));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+        ptr += 8;
+    }
+    if (ptr + 4 <= end) {
+        h ^= (uint64_t) read32(ptr) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        ptr += 4;
+    }
+    while (ptr < end) {
+        h ^= (*ptr) * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+        ptr++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+bool hash_file(const char* path, uint64_t* result) {
+    FILE* fd = fopen(path, "rb");
+    if (!fd) return false;
+    fseek(fd, 0, SEEK_END);
+    long size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(fd);
+        return false;
+    }
+    char* data = memloc(size+1);
+    size_t got = fread(data, sizeof(char), size, fd);
+    fclose(fd);
+    *result = hash_xxh64(data, got, 0);
+    memfree(data);
+    return got == (size_t) size;
+}
@@ -0,0 +1,20 @@
+#ifndef s7k_hash_lib
+#define s7k_hash_lib
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+// FNV-1a, good enough for table keys and short strings
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+uint64_t hash_string(const char* str, uint64_t seed);
+
+// XXH64, for file contents
+uint64_t hash_xxh64(const void* data, size_t size, uint64_t seed);
+// hashes the whole file with XXH64
+// @return false if the file cannot be read
+bool hash_file(const char* path, uint64_t* result);
+
+#endif
@@ -1,385 +1,969 @@
 #include "json.h"
 
-void init_json() {
-    set_funcs(memloc, memfree, memcpy);
-    prealloc(PAGE_SIZE);
-}
+#include <float.h>
+#include <math.h>
+#include "hash.h"
+#include "jsonscan.h"
 
-void exit_on_error(int code) {
-    page_info(0);
-    destroy_pages();
-    exit(code);
+#if !defined(WIN32)
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void init_json() {
+    set_funcs(memloc, memfree, memcpy, memrealloc);
 }
 
 // reads the entire file
 char* read_from_file(FILE* fd, size_t size) {
-    char *str = memloc(size);
-    fread(str, sizeof(char), size, fd);
+    char *str = memloc(size+1);
+    size = fread(str, sizeof(char), size, fd);
+    str[size] = '\0';
     return str;
 }
 
-char* string_from_ptrs(char* start, char* end) {
-    char *str = memloc(sizeof(char)*(end-start+1));
-    memcpy(str, start, sizeof(char)*(end-start+1));
-    str[end-start] = '\0';
-    return str;
+static bool parse_error(json_parser* ps, const char* msg) {
+    if (ps->failed) return false;
+    size_t line = 1;
+    for (char* ptr = ps->start; ptr < ps->ptr; ptr++) {
+        if (*ptr == '\n') line++;
+    }
+    printf("JSON syntax error at line %zu: %s\n", line, msg);
+    ps->failed = true;
+    return false;
 }
 
-char* remove_spaces(char* str, size_t size) {
-    while (size!=0 && (*str <=32)) {
-        str++; size--;
+static void skip_spaces(json_parser* ps) {
+    while (ps->ptr < ps->end && (*ps->ptr==' ' || *ps->ptr=='\n' || *ps->ptr=='\r' || *ps->ptr=='\t')) {
+        ps->ptr++;
     }
-    while (size!=0 && (*(str+size-1) <= 32)) {
-        size--;
+}
+
+// @return true and skips symb if it is the next non-space character
+static bool accept(json_parser* ps, char symb) {
+    skip_spaces(ps);
+    if (ps->ptr < ps->end && *ps->ptr == symb) {
+        ps->ptr++;
+        return true;
     }
-    char* res;
-    if (size==0) return NULL;
-    res = string_from_ptrs(str, str+size);
-    return res;
+    return false;
 }
 
-size_t count_of(char *start, char *end, char symb) {
-    char* ptr = start;
-    size_t size = 0;
-    while (ptr && ptr<end) {
-        ptr = strchr(ptr, symb);
-        if (!ptr || ptr>=end) break;
-        size++;
-        ptr++;
+static int hex_digit(char c) {
+    if (c>='0' && c<='9') return c-'0';
+    if (c>='a' && c<='f') return c-'a'+10;
+    if (c>='A' && c<='F') return c-'A'+10;
+    return -1;
+}
+
+// @return code unit of \uXXXX after the "\u", or -1
+static long parse_hex4(json_parser* ps) {
+    if (ps->end - ps->ptr < 4) return -1;
+    long code = 0;
+    for (int i=0; i<4; i++) {
+        int d = hex_digit(ps->ptr[i]);
+        if (d < 0) return -1;
+        code = code*16 + d;
     }
-    return size;
+    ps->ptr += 4;
+    return code;
 }
 
-// splits everything into pairs
-// @return vector of tokens
-Token* split_into_pairs(char *str, size_t size, int array) {
-    char *ptr, *start;
-    char *end = str+size;
-    char stopsymb = '}';
-    char symsymb = '{';
-    if (array) {
-        stopsymb = ']';
-        symsymb = '[';
+static char* put_utf8(char* out, long code) {
+    if (code < 0x80) {
+        *out++ = code;
+    } else if (code < 0x800) {
+        *out++ = 0xC0 | (code>>6);
+        *out++ = 0x80 | (code & 0x3F);
+    } else if (code < 0x10000) {
+        *out++ = 0xE0 | (code>>12);
+        *out++ = 0x80 | ((code>>6) & 0x3F);
+        *out++ = 0x80 | (code & 0x3F);
+    } else {
+        *out++ = 0xF0 | (code>>18);
+        *out++ = 0x80 | ((code>>12) & 0x3F);
+        *out++ = 0x80 | ((code>>6) & 0x3F);
+        *out++ = 0x80 | (code & 0x3F);
     }
-    while (size!=0 && *end != stopsymb) {
-        end--; size--;
+    return out;
+}
+
+// parses a string after its opening quote, unescaping it in place
+// @return the string inside the buffer or NULL
+static char* parse_string(json_parser* ps) {
+    // the closing quote is the next structural character after the opening one
+    uint32_t open = ps->ptr - ps->start - 1;
+    size_t count = vec_meta(ps->structurals).length;
+    while (ps->cursor < count && ps->structurals[ps->cursor] <= open) ps->cursor++;
+    if (ps->cursor == count || ps->start[ps->structurals[ps->cursor]] != '"') {
+        parse_error(ps, "unterminated string");
+        return NULL;
     }
-    if (size==0) {
-        printf("Not found global %c\n", stopsymb);
-        exit_on_error(1);
+    char* close = ps->start + ps->structurals[ps->cursor++];
+    char* str = ps->ptr;
+    char* out = memchr(str, '\\', close-str);
+    if (!out) out = close;
+    ps->ptr = out;
+    while (ps->ptr < close) {
+        char c = *ps->ptr++;
+        if (c != '\\') {
+            *out++ = c;
+            continue;
+        }
+        c = *ps->ptr++;
+        switch (c) {
+            case '"': case '\\': case '/': *out++ = c; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                // every escape is longer than its UTF-8, out never passes ptr
+                long code = parse_hex4(ps);
+                // surrogate pair
+                if (code >= 0xD800 && code < 0xDC00 && close - ps->ptr >= 2 && ps->ptr[0]=='\\' && ps->ptr[1]=='u') {
+                    ps->ptr += 2;
+                    long low = parse_hex4(ps);
+                    if (low >= 0xDC00 && low < 0xE000) code = 0x10000 + ((code-0xD800)<<10) + (low-0xDC00);
+                    else code = -1;
+                }
+                // a lone half of a pair is not a character
+                if (code >= 0xD800 && code < 0xE000) code = -1;
+                if (code >= 0 && ps->ptr <= close) {
+                    out = put_utf8(out, code);
+                    break;
+                }
+            } // fall through
+            default:
+                parse_error(ps, "wrong escape sequence");
+                return NULL;
+        }
     }
-    
-    Token* vec = new_vec(sizeof(Token), 10);
-    Token temp;
+    *out = '\0';
+    ps->ptr = close+1;
+    return str;
+}
 
-    // printf("%s|\n\n", string_from_ptrs(str, end));
-    // printf("|%c %c|\n", *str, *end);
-    for (ptr = str+1; ptr < end; ptr++) {
-        if (*ptr == ',') {
-            ptr++;
+// powers of ten that are exact doubles
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const char* json_parse_number(const char* ptr, const char* end, json_object* obj) {
+    const char* start = ptr;
+    bool negative = ptr < end && *ptr == '-';
+    if (negative) ptr++;
+    // up to 19 significant digits always fit
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool truncated = false, integer = true;
+
+    const char* first = ptr;
+    for (; ptr < end && *ptr>='0' && *ptr<='9'; ptr++) {
+        if (digits < 19) {
+            mantissa = mantissa*10 + (*ptr-'0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+            truncated = true;
         }
-        if (*ptr=='\n' || *ptr=='\t') {
-            continue;
+    }
+    // no leading zeros
+    if (ptr == first || (*first == '0' && ptr-first > 1)) return NULL;
+    if (ptr < end && *ptr == '.') {
+        integer = false;
+        first = ++ptr;
+        for (; ptr < end && *ptr>='0' && *ptr<='9'; ptr++) {
+            if (digits < 19) {
+                mantissa = mantissa*10 + (*ptr-'0');
+                if (mantissa) digits++;
+                exponent--;
+            } else {
+                truncated = true;
+            }
         }
+        if (ptr == first) return NULL;
+    }
+    if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+        integer = false;
+        ptr++;
+        bool below = ptr < end && *ptr == '-';
+        if (ptr < end && (*ptr == '-' || *ptr == '+')) ptr++;
+        first = ptr;
+        int value = 0;
+        for (; ptr < end && *ptr>='0' && *ptr<='9'; ptr++) {
+            if (value < 100000) value = value*10 + (*ptr-'0');
+        }
+        if (ptr == first) return NULL;
+        exponent += (below) ? -value : value;
+    }
 
-        start = ptr;
-        ptr = strchr(ptr, ',');
-        if (!ptr) ptr = end;
-
-        if (*ptr == '\0') ptr--;
-        // if (ptr==end) ptr--;
-        temp.start = start; temp.end = ptr; temp.parent = NULL;
-        // printf("<%c %c>\n", *start, *ptr);
-        vec = vec_add(vec, &temp);
-    }
-    vector_metainfo *meta = vec_metaptr(vec);
-    Token* pairs = new_vec(sizeof(Token), 10);
-    
-    for (int i=0; i<meta->length; i++) {
-        temp = vec[i];
-        // printf("%s\n\n", string_from_ptrs(temp.start, temp.end));
-        if (count_of(temp.start, temp.end, '"')%2 == 1) {
-            if (i!=meta->length-1) {
-                vec[i+1].start = temp.start;
-                continue;
-            }
-            printf("Syntax error with \"\n");
-            printf("%s\n", string_from_ptrs(temp.start, temp.end));
-            exit_on_error(1);
+    if (integer && !truncated) {
+        if (!negative && mantissa <= INT64_MAX) {
+            obj->type = INT;
+            obj->data.num = mantissa;
+            return ptr;
         }
-        if (count_of(temp.start, temp.end, '[') != count_of(temp.start, temp.end, ']')) {
-            if (i!=meta->length-1) {
-                vec[i+1].start = temp.start;
-                continue;
-            }
-            printf("Syntax error with []\n");
-            // printf("%s\n", string_from_ptrs(vec[i-1].start, vec[i-1].end));
-            printf("%s\n", string_from_ptrs(temp.start, temp.end));
-            exit_on_error(1);
-        } 
-        if (count_of(temp.start, temp.end, '{') != count_of(temp.start, temp.end, '}')) {
-            if (i!=meta->length-1) {
-                vec[i+1].start = temp.start;
-                continue;
-            }
-            printf("Syntax error with {}\n");
-            printf("%s\n", string_from_ptrs(temp.start, temp.end));
-            exit_on_error(1);
+        if (negative && mantissa <= (uint64_t) INT64_MAX+1) {
+            obj->type = INT;
+            obj->data.num = (int64_t) (0-mantissa);
+            return ptr;
         }
-        pairs = vec_add(pairs, &temp);
     }
-    delete_vec(vec);
-    return pairs;
+    obj->type = FLOAT;
+    // Clinger's fast path: one correctly rounded operation on exact values
+    if (!truncated && mantissa <= (1ULL<<53) && exponent >= -22 && exponent <= 22) {
+        double value = mantissa;
+        value = (exponent < 0) ? value / exact_powers[-exponent] : value * exact_powers[exponent];
+        obj->data.dec = (negative) ? -value : value;
+        return ptr;
+    }
+    // long mantissas and large exponents are rare in build files
+    obj->data.dec = strtod(start, NULL);
+    return ptr;
+}
+
+static bool parse_number(json_parser* ps, json_object* obj) {
+    const char* ptr = json_parse_number(ps->ptr, ps->end, obj);
+    if (!ptr) return parse_error(ps, "wrong number");
+    ps->ptr = (char*) ptr;
+    return true;
+}
+
+// @return true and skips word if the input continues with it
+static bool parse_word(json_parser* ps, const char* word) {
+    size_t len = strlen(word);
+    if (ps->end - ps->ptr < len || strncmp(ps->ptr, word, len)!=0) return false;
+    ps->ptr += len;
+    return true;
+}
+
+static bool parse_value(json_parser* ps, json_object* obj);
+
+// @return slots of the key index of an object with count fields, 0 if it has none
+static size_t index_slots(size_t count) {
+    if (count < JSON_INDEX_MIN) return 0;
+    size_t slots = 1;
+    while (slots < count*2) slots *= 2;
+    return slots;
+}
+
+// @return bytes of a key index with slots, the next container stays aligned
+static size_t index_bytes(size_t slots) {
+    size_t bytes = (slots+1)*sizeof(uint32_t);
+    return (bytes + _Alignof(json_pair)-1) & ~(_Alignof(json_pair)-1);
 }
 
-json_pair parse_pair(Token *tk) {
-    json_pair pair;
-    char* ptr = strchr(tk->start, ':');
-    if (!ptr || ptr>=tk->end) {
-        printf("Cannot parse pair\n%s\n", string_from_ptrs(tk->start, tk->end));
-        exit_on_error(1);
+char* json_intern_find(json_keys* keys, const char* key, uint64_t hash) {
+    if (!keys->capacity) return NULL;
+    size_t slot = hash & (keys->capacity-1);
+    while (keys->slots[slot]) {
+        if (strcmp(keys->slots[slot], key)==0) return keys->slots[slot];
+        slot = (slot+1) & (keys->capacity-1);
     }
-    char* key = remove_spaces(tk->start+1, ptr-tk->start-1);
-    char* value = remove_spaces(ptr+1, tk->end-ptr-1);
-    size_t keysize = strlen(key);
-    if (*key=='"') {
-        key++; keysize--;
+    return NULL;
+}
+
+char* json_intern(json_keys* keys, char* key, uint64_t hash) {
+    char* found = json_intern_find(keys, key, hash);
+    if (found) return found;
+    if (keys->count*2 >= keys->capacity) {
+        size_t capacity = (keys->capacity) ? keys->capacity*2 : 64;
+        char** slots = memloc(sizeof(char*)*capacity);
+        memset(slots, 0, sizeof(char*)*capacity);
+        for (size_t i=0; i<keys->capacity; i++) {
+            if (!keys->slots[i]) continue;
+            size_t slot = hash_string(keys->slots[i], HASH_SEED) & (capacity-1);
+            while (slots[slot]) slot = (slot+1) & (capacity-1);
+            slots[slot] = keys->slots[i];
+        }
+        if (keys->slots) memfree(keys->slots);
+        keys->slots = slots;
+        keys->capacity = capacity;
     }
-    if (*(key+keysize-1)=='"'){
-        key[keysize-1] = '\0';
+    size_t slot = hash & (keys->capacity-1);
+    while (keys->slots[slot]) slot = (slot+1) & (keys->capacity-1);
+    keys->slots[slot] = key;
+    keys->count++;
+    return key;
+}
+
+void json_keys_free(json_keys* keys) {
+    if (keys->slots) memfree(keys->slots);
+    keys->slots = NULL;
+    keys->count = keys->capacity = 0;
+}
+
+// next container in document order, a full-size vector in the arena
+static vector new_container(json_parser* ps, size_t elem_size) {
+    vector_metainfo* meta = (vector_metainfo*) ps->arena;
+    meta->length = 0;
+    meta->capacity = ps->containers[ps->container++].count;
+    meta->size = elem_size;
+    ps->arena += sizeof(vector_metainfo) + meta->capacity*elem_size;
+    return meta+1;
+}
+
+// @return place for the next element of a container of the arena
+static void* next_element(json_parser* ps, vector vec) {
+    vector_metainfo* meta = vec_metaptr(vec);
+    if (meta->length == meta->capacity) {
+        parse_error(ps, "wrong structure");
+        return NULL;
     }
-    pair.key = key;
-    // printf("%s\n", value);
-    //printf("SIZE OF %s %d\n", value, strlen(value));
-    pair.value = read_object(value, strlen(value)+1);
-    memfree(value);
-    return pair;   
+    return (char*) vec + meta->size*meta->length++;
 }
 
-json_object_types object_type(char* value, size_t size) {
-    json_object_types type;
-    switch (*value) {
-        case '[':
-            type = ARRAY;
-            break;
-        case '{':
-            type = CHILD;
-            break;
-        case '"':
-            type = STR;
-            break;
-        default:
-            type = INT;
+// one range of the elements of a large array
+typedef struct json_part {
+    json_parser ps;
+    json_object* array;
+    size_t element; // index of the next element
+    char* stop; // start of the next part, NULL for the last one
+    size_t first; // first container of the part
+} json_part;
+
+static void* parse_part(void* arg) {
+    json_part* part = arg;
+    json_parser* ps = &part->ps;
+    size_t capacity = vec_meta(part->array).capacity;
+    skip_spaces(ps);
+    while (!part->stop || ps->ptr < part->stop) {
+        if (part->element == capacity) {
+            parse_error(ps, "wrong structure");
             break;
+        }
+        if (!parse_value(ps, part->array + part->element++) || !accept(ps, ',')) break;
+        skip_spaces(ps);
     }
-    char* ptr;
-    if (type == INT) {
-        ptr = strchr(value, '.');
-        if (ptr && ptr<value+size) {
-            type = FLOAT;
+    // the next part starts after a comma
+    if (part->stop && ps->ptr != part->stop) parse_error(ps, "expected , or ]");
+    return NULL;
+}
+
+static vector container_at(json_parser* ps, size_t index) {
+    return ps->arena_start + ps->containers[index].offset + sizeof(vector_metainfo);
+}
+
+// @return number of parts the array at index is split into, 0 if it is
+// parsed in one go, a part starts at one of the containers of the array
+static size_t split_array(json_parser* ps, size_t index, size_t* starts) {
+    json_container* all = ps->containers;
+    size_t end = all[index].after;
+    // the first child is parsed before the parts to intern its keys
+    size_t second = index+1;
+    if (second >= end || (second = all[second].after) >= end) return 0;
+    size_t last = second;
+    while (all[last].after < end) last = all[last].after;
+    uint32_t from = ps->structurals[all[second].open];
+    uint32_t span = ps->structurals[all[last].open] - from;
+    size_t parts = span / JSON_PART_MIN;
+    if (parts > ps->threads) parts = ps->threads;
+    if (parts > JSON_PARTS_MAX) parts = JSON_PARTS_MAX;
+    if (parts < 2) return 0;
+    size_t count = 0;
+    for (size_t child = second; child < end && count < parts; child = all[child].after) {
+        if (ps->structurals[all[child].open] - from >= (uint64_t) span*count/parts) starts[count++] = child;
+    }
+    return count;
+}
+
+// interns the keys a part could not find in the document's set
+static void intern_part(json_parser* ps, size_t first, size_t end) {
+    for (size_t i=first; i<end; i++) {
+        if (!ps->containers[i].object) continue;
+        json_pair* fields = container_at(ps, i);
+        vector_metainfo meta = vec_meta(fields);
+        for (size_t j=0; j<meta.length; j++) {
+            fields[j].key = json_intern(&ps->keys, fields[j].key, fields[j].hash);
         }
     }
+}
+
+// parses the elements of a large array on several threads, every part
+// writes its own containers to their places in the arena
+// @return false if the array is left to be parsed in one go
+static bool parse_parts(json_parser* ps, json_object* array, size_t index) {
+#if defined(WIN32)
+    return false;
+#else
+    size_t starts[JSON_PARTS_MAX];
+    size_t count = split_array(ps, index, starts);
+    if (!count) return false;
+    // elements before the first part are parsed here
+    json_part parts[JSON_PARTS_MAX+1];
+    parts[0].ps = *ps;
+    parts[0].array = array;
+    parts[0].element = 0;
+    parts[0].stop = ps->start + ps->structurals[ps->containers[starts[0]].open];
+    parse_part(&parts[0]);
+    *ps = parts[0].ps;
+    if (ps->failed) return true;
 
-    return type;
+    pthread_t threads[JSON_PARTS_MAX];
+    bool started[JSON_PARTS_MAX];
+    for (size_t i=1; i<=count; i++) {
+        json_container* first = ps->containers + starts[i-1];
+        json_part* part = parts + i;
+        part->ps = *ps;
+        part->ps.ptr = ps->start + ps->structurals[first->open];
+        part->ps.cursor = first->open;
+        part->ps.container = starts[i-1];
+        part->ps.arena = ps->arena_start + first->offset;
+        part->ps.part = true;
+        part->ps.missed = false;
+        part->array = array;
+        part->element = first->element;
+        part->stop = (i < count) ? ps->start + ps->structurals[ps->containers[starts[i]].open] : NULL;
+        part->first = starts[i-1];
+        // parsed here if no thread is left
+        started[i-1] = pthread_create(threads+i-1, NULL, parse_part, part) == 0;
+        if (!started[i-1]) parse_part(part);
+    }
+    for (size_t i=1; i<=count; i++) {
+        if (started[i-1]) pthread_join(threads[i-1], NULL);
+        if (parts[i].ps.failed) ps->failed = true;
+    }
+    json_part* last = parts + count;
+    for (size_t i=1; i<=count && !ps->failed; i++) {
+        size_t end = (i < count) ? parts[i+1].first : last->ps.container;
+        if (parts[i].ps.missed) intern_part(ps, parts[i].first, end);
+    }
+    vec_metaptr(array)->length = last->element;
+    ps->ptr = last->ps.ptr;
+    ps->cursor = last->ps.cursor;
+    ps->container = last->ps.container;
+    ps->arena = last->ps.arena;
+    return true;
+#endif
 }
 
-json_object read_object(char* value, size_t size) {
-    // printf("%s\n", value);
-    json_object_types type = object_type(value, size);
-    json_object obj; obj.type = type;
-    // json_child *child;
-    switch (type) {
-        case STR:
-            obj.data.str = string_from_ptrs(value+1, value+size-1);
-            int s = strlen(obj.data.str);
-            if (obj.data.str[s-1]=='"') obj.data.str[s-1]='\0';
-            // printf("%s | %s\n", value, obj.data.str);
-            break;
-        case INT:
-            obj.data.num = strtol(value, NULL, 0);
-            // printf("num | %d\n", obj.data.num);
-            break;
-        case FLOAT:
-            obj.data.dec = strtof(value, NULL);
-            // printf("dec | %f\n", obj.data.dec);
-            break;
-        case ARRAY:
-            obj.data.array = read_array(value, size);
-            // printf("array | %s\n", value);
-            break;
-        case CHILD:
-            // printf("child | %s\n", value);
-            // child = memloc(sizeof(json_child));
-            // *child = read_child(value, size);
-            obj.data.child = read_child(value, size);
-            break;
+static bool parse_array(json_parser* ps, json_object** array) {
+    size_t index = ps->container;
+    *array = new_container(ps, sizeof(json_object));
+    if (accept(ps, ']')) return true;
+    if (ps->threads > 1 && !ps->part && parse_parts(ps, *array, index)) {
+        if (ps->failed) return false;
+        if (!accept(ps, ']')) return parse_error(ps, "expected , or ]");
+        return true;
+    }
+    do {
+        json_object* temp = next_element(ps, *array);
+        if (!temp || !parse_value(ps, temp)) return false;
+    } while (accept(ps, ','));
+    if (!accept(ps, ']')) return parse_error(ps, "expected , or ]");
+    return true;
+}
+
+static bool parse_child(json_parser* ps, json_child* child) {
+    child->fields = new_container(ps, sizeof(json_pair));
+    child->index = NULL;
+    size_t slots = index_slots(vec_meta(child->fields).capacity);
+    if (slots) {
+        // reserved here, filled by the first json_get()
+        child->index = (uint32_t*) ps->arena;
+        child->index[0] = 0;
+        ps->arena += index_bytes(slots);
+    }
+    if (accept(ps, '}')) return true;
+    do {
+        json_pair* temp = next_element(ps, child->fields);
+        if (!temp) return false;
+        if (!accept(ps, '"')) return parse_error(ps, "expected key");
+        temp->key = parse_string(ps);
+        if (!temp->key) return false;
+        temp->hash = hash_string(temp->key, HASH_SEED);
+        if (!ps->part) {
+            temp->key = json_intern(&ps->keys, temp->key, temp->hash);
+        } else {
+            // other parts read the set at the same time
+            char* key = json_intern_find(&ps->keys, temp->key, temp->hash);
+            if (key) temp->key = key;
+            else ps->missed = true;
+        }
+        if (!accept(ps, ':')) return parse_error(ps, "expected :");
+        if (!parse_value(ps, &temp->value)) return false;
+    } while (accept(ps, ','));
+    if (!accept(ps, '}')) return parse_error(ps, "expected , or }");
+    return true;
+}
+
+static bool parse_value(json_parser* ps, json_object* obj) {
+    skip_spaces(ps);
+    if (ps->ptr >= ps->end) return parse_error(ps, "unexpected end of file");
+    switch (*ps->ptr) {
+        case '{':
+            ps->ptr++;
+            obj->type = CHILD;
+            return parse_child(ps, &obj->data.child);
+        case '[':
+            ps->ptr++;
+            obj->type = ARRAY;
+            return parse_array(ps, &obj->data.array);
+        case '"':
+            ps->ptr++;
+            obj->type = STR;
+            obj->data.str = parse_string(ps);
+            return obj->data.str != NULL;
         default:
             break;
     }
-    return obj;
+    obj->type = BOOL;
+    if (parse_word(ps, "true")) {
+        obj->data.boolean = true;
+        return true;
+    }
+    if (parse_word(ps, "false")) {
+        obj->data.boolean = false;
+        return true;
+    }
+    obj->type = NIL;
+    if (parse_word(ps, "null")) return true;
+    return parse_number(ps, obj);
+}
+
+static bool is_blank(const char* start, const char* end) {
+    for (; start < end; start++) {
+        if (*start!=' ' && *start!='\n' && *start!='\r' && *start!='\t') return false;
+    }
+    return true;
 }
 
-// @return vector of objects
-json_object *read_array(char *value, size_t size) {
-    // printf("%s\n\n", string_from_ptrs(value, value+size));
-    Token* pairs = split_into_pairs(value, size, 1); // vector
-    vector_metainfo meta = vec_meta(pairs);
-    json_object *array = new_vec(sizeof(json_object), meta.length);
-    json_object temp;
+// finds every container in document order from the structural
+// characters and counts its elements, only scalars are looked at byte by byte
+// @return bytes of the arena holding all containers
+static size_t prescan(json_parser* ps) {
+    size_t* open = new_vec(sizeof(size_t), STANDART_PREALLOC); // indices into containers
+    ps->containers = new_vec(sizeof(json_container), STANDART_PREALLOC);
+    bool empty = true; // no element seen yet in the innermost container
+    size_t last = 0; // after the previous structural character
+    size_t count = vec_meta(ps->structurals).length;
+    for (size_t i=0; i<count; i++) {
+        size_t pos = ps->structurals[i];
+        char c = ps->start[pos];
+        vector_metainfo* depth = vec_metaptr(open);
+        json_container* parent = (depth->length) ? ps->containers + open[depth->length-1] : NULL;
+        if (c == ':') {
+            last = pos+1;
+            continue;
+        }
+        if (parent && empty) {
+            // a scalar before , } or ] is the first element
+            if (c == '{' || c == '[' || c == '"' || !is_blank(ps->start+last, ps->start+pos)) parent->count++;
+            empty = false;
+        }
+        if (c == ',') {
+            if (parent) parent->count++;
+        } else if (c == '}' || c == ']') {
+            if (parent) parent->after = vec_meta(ps->containers).length;
+            if (depth->length) depth->length--;
+        } else if (c == '{' || c == '[') {
+            size_t index = vec_meta(ps->containers).length;
+            json_container container = {0};
+            container.open = i;
+            container.element = (parent && parent->count) ? parent->count-1 : 0;
+            container.object = c == '{';
+            ps->containers = vec_add(ps->containers, &container);
+            open = vec_add(open, &index);
+            empty = true;
+        } else if (c == '"' && i+1 < count) {
+            // skip the closing quote
+            pos = ps->structurals[++i];
+        }
+        last = pos+1;
+    }
+    size_t bytes = 0;
+    vector_metainfo meta = vec_meta(ps->containers);
     for (int i=0; i<meta.length; i++) {
-        // printf(remove_spaces(pairs[i].start, pairs[i].end - pairs[i].start));
-        // printf("##\n");
-        temp = read_object(remove_spaces(pairs[i].start, pairs[i].end - pairs[i].start),
-                pairs[i].end - pairs[i].start);
-        // printf("%d\n", temp.type);
-        array = vec_add(array, &temp);
+        json_container* container = ps->containers + i;
+        // left open by a broken document
+        if (!container->after) container->after = meta.length;
+        container->offset = bytes;
+        bytes += sizeof(vector_metainfo);
+        if (!container->object) {
+            bytes += container->count*sizeof(json_object);
+            continue;
+        }
+        bytes += container->count*sizeof(json_pair);
+        size_t slots = index_slots(container->count);
+        if (slots) bytes += index_bytes(slots);
     }
-    delete_vec(pairs);
-    return array;
+    delete_vec(open);
+    return bytes;
 }
 
-json_child read_child(char *str, size_t size) {
-    Token* pairs = split_into_pairs(str, size+1, 0); // vector
-    vector_metainfo meta = vec_meta(pairs);
+// @return number of threads to parse large arrays with
+static size_t parse_threads() {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return n;
+#endif
+    return 1;
+}
+
+// parses the document into one arena allocated for its containers
+// @param keys gets the interned keys, they are freed if it is NULL
+static json_child parse_document(char* str, size_t size, void** arena, json_keys* keys) {
+    json_parser ps;
+    ps.start = ps.ptr = str;
+    ps.end = str+size;
+    ps.failed = false;
+    ps.container = 0;
+    ps.keys = (json_keys) {0};
+    ps.threads = parse_threads();
+    ps.part = false;
     json_child child;
-    child.fields = new_vec(sizeof(json_pair), meta.length);
-    json_pair temp;
-    for (int i=0; i<meta.length; i++) {
-        temp = parse_pair(pairs+i);
-        child.fields = vec_add(child.fields, &temp);
+    child.fields = NULL;
+    *arena = NULL;
+    if (keys) *keys = ps.keys;
+    // positions of the structural index are 32 bit
+    if (size > UINT32_MAX) {
+        printf("JSON file is too large\n");
+        return child;
+    }
+    ps.structurals = jsonscan(str, size);
+    ps.cursor = 0;
+    *arena = memloc(MEM_FROZEN_PAD + prescan(&ps) + 1);
+    memset(*arena, 0, MEM_FROZEN_PAD);
+    ps.arena_start = ps.arena = (char*) *arena + MEM_FROZEN_PAD;
+    if (!accept(&ps, '{')) {
+        parse_error(&ps, "expected {");
+    } else if (parse_child(&ps, &child)) {
+        skip_spaces(&ps);
+        if (ps.ptr < ps.end && *ps.ptr) parse_error(&ps, "unexpected data after the end");
     }
-    delete_vec(pairs);
+    delete_vec(ps.containers);
+    delete_vec(ps.structurals);
+    if (keys) *keys = ps.keys;
+    else json_keys_free(&ps.keys);
+    if (ps.failed) child.fields = NULL;
     return child;
 }
 
+json_child read_child(char *str, size_t size) {
+    void* arena;
+    return parse_document(str, size, &arena, NULL);
+}
+
+static void build_index(json_child* child) {
+    vector_metainfo meta = vec_meta(child->fields);
+    uint32_t slots = index_slots(meta.capacity);
+    memset(child->index+1, 0, slots*sizeof(uint32_t));
+    for (uint32_t i=0; i<meta.length; i++) {
+        uint32_t slot = child->fields[i].hash & (slots-1);
+        while (child->index[1+slot]) slot = (slot+1) & (slots-1);
+        // keeps the first of duplicate keys, as the linear search does
+        child->index[1+slot] = i+1;
+    }
+    child->index[0] = slots;
+}
+
+// an interned key matches by its pointer, any other string by hash and strcmp()
+json_object* json_get(json_child* child, const char* key) {
+    uint64_t hash = hash_string(key, HASH_SEED);
+    json_pair* fields = child->fields;
+    if (child->index) {
+        if (!child->index[0]) build_index(child);
+        uint32_t slots = child->index[0];
+        for (uint32_t slot = hash & (slots-1); child->index[1+slot]; slot = (slot+1) & (slots-1)) {
+            json_pair* pair = fields + child->index[1+slot]-1;
+            if (pair->key == key || (pair->hash == hash && strcmp(pair->key, key)==0)) return &pair->value;
+        }
+        return NULL;
+    }
+    vector_metainfo meta = vec_meta(fields);
+    for (int i=0; i<meta.length; i++) {
+        if (fields[i].key == key || (fields[i].hash == hash && strcmp(fields[i].key, key)==0)) return &fields[i].value;
+    }
+    return NULL;
+}
+
+// @return true if the whole file is mapped copy-on-write
+static bool map_file(FILE* fd, json_document* doc) {
+#if defined(WIN32)
+    return false;
+#else
+    struct stat st;
+    if (fstat(fileno(fd), &st) != 0 || st.st_size == 0) return false;
+    // the parser may read one byte past the end, it must be inside the mapping
+    if (st.st_size % sysconf(_SC_PAGESIZE) == 0) return false;
+    void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+    if (data == MAP_FAILED) return false;
+    doc->data = data;
+    doc->size = st.st_size;
+    doc->mapped = true;
+    return true;
+#endif
+}
+
+bool json_open(FILE* fd, json_document* doc) {
+    if (!map_file(fd, doc)) {
+        fseek(fd, 0, SEEK_END);
+        doc->size = ftell(fd);
+        fseek(fd, 0, SEEK_SET);
+        doc->data = read_from_file(fd, doc->size);
+        doc->mapped = false;
+    }
+    doc->root = parse_document(doc->data, doc->size, &doc->arena, &doc->keys);
+    return doc->root.fields != NULL;
+}
+
+void json_close(json_document* doc) {
+    if (!doc->data) return;
+#if !defined(WIN32)
+    if (doc->mapped) munmap(doc->data, doc->size);
+    else
+#endif
+    memfree(doc->data);
+    if (doc->arena) memfree(doc->arena);
+    json_keys_free(&doc->keys);
+    doc->data = NULL;
+    doc->root.fields = NULL;
+}
+
 json_child read_json(FILE* fd) {
     fseek(fd, 0, SEEK_END);
     size_t size = ftell(fd);
     fseek(fd, 0, SEEK_SET);
+    // strings point into the buffer, it lives until destroy_pages()
     char* str = read_from_file(fd, size);
-    json_child result = read_child(str, size);
-    memfree(str);
-    return result;
+    return read_child(str, size);
 }
 
 
-void fprintarray(FILE *fd, json_object *array, size_t tabs) {
-    size_t iter;
+static bool writer_flush(json_writer* wr) {
+    if (!wr->fd || wr->len == 0) return true;
+    if (fwrite(wr->buffer, 1, wr->len, wr->fd) != wr->len) wr->failed = true;
+    wr->len = 0;
+    return !wr->failed;
+}
 
-    // iter = tabs;
-    // while (iter>0) {
-    //     printf("\t");
-    //     iter--;
-    // } 
-    fprintf(fd, "[\n");
+// @return space for at least size more bytes
+static char* writer_reserve(json_writer* wr, size_t size) {
+    if (wr->len + size <= wr->capacity) return wr->buffer + wr->len;
+    if (wr->fd && size <= wr->capacity) {
+        writer_flush(wr);
+        return wr->buffer;
+    }
+    size_t capacity = wr->capacity*2;
+    while (capacity < wr->len + size) capacity *= 2;
+    char* buffer = memloc(capacity);
+    memcpy(buffer, wr->buffer, wr->len);
+    memfree(wr->buffer);
+    wr->buffer = buffer;
+    wr->capacity = capacity;
+    return wr->buffer + wr->len;
+}
 
-    // tabs++;
-    vector_metainfo meta = vec_meta(array);
-    // printf("size %d\n", meta.length);
-    json_object temp;
-    // for (int i=0; i<meta.length; i++) {
-    //     printf("%d ", array[i].type);
-    // }
-    for (int i=0; i<meta.length; i++) {
-        temp = array[i];
-        iter = tabs;
-        while (iter>0) {
-            fprintf(fd, "\t");
-            iter--;
-        } 
-        switch (temp.type) {
-            case STR:
-                fprintf(fd, "\"%s\"", temp.data.str);
-                break;
-            case INT:
-                fprintf(fd, "%d", temp.data.num);
-                break;
-            case FLOAT:
-                fprintf(fd, "%f", temp.data.dec);
-                break;
-            case CHILD:
-                fprintchild(fd, &temp.data.child, tabs);
-                break;
-            case ARRAY:
-                fprintarray(fd, temp.data.array, tabs+1);
-                break;
+static void write_bytes(json_writer* wr, const char* str, size_t len) {
+    memcpy(writer_reserve(wr, len), str, len);
+    wr->len += len;
+}
+
+static void write_char(json_writer* wr, char c) {
+    *writer_reserve(wr, 1) = c;
+    wr->len++;
+}
+
+static void write_indent(json_writer* wr) {
+    if (wr->style == JSON_COMPACT) return;
+    char* out = writer_reserve(wr, wr->depth+1);
+    *out++ = '\n';
+    memset(out, '\t', wr->depth);
+    wr->len += wr->depth+1;
+}
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void write_int(json_writer* wr, long long num) {
+    char buff[24];
+    char* end = buff + sizeof(buff);
+    char* ptr = end;
+    unsigned long long value = (num < 0) ? -(unsigned long long) num : num;
+    // two digits at a time
+    while (value >= 100) {
+        unsigned idx = (value % 100)*2;
+        value /= 100;
+        *--ptr = digit_pairs[idx+1];
+        *--ptr = digit_pairs[idx];
+    }
+    if (value >= 10) {
+        *--ptr = digit_pairs[value*2+1];
+        *--ptr = digit_pairs[value*2];
+    } else {
+        *--ptr = '0' + value;
+    }
+    if (num < 0) *--ptr = '-';
+    write_bytes(wr, ptr, end-ptr);
+}
 
+// shortest digits that read back as the same double
+static void write_float(json_writer* wr, double dec) {
+    char buff[32];
+    if (isnan(dec) || isinf(dec)) {
+        write_bytes(wr, "null", 4);
+        return;
+    }
+    // the integer path would drop the sign
+    if (dec == 0 && signbit(dec)) {
+        write_bytes(wr, "-0.0", 4);
+        return;
+    }
+    if (dec > -1e15 && dec < 1e15 && dec == (long long) dec) {
+        write_int(wr, (long long) dec);
+        write_bytes(wr, ".0", 2);
+        return;
+    }
+    // normal doubles are never closer than DBL_DIG digits to each other,
+    // subnormals have fewer significant bits
+    int len = 0;
+    bool subnormal = dec > -DBL_MIN && dec < DBL_MIN;
+    for (int precision = (subnormal) ? 1 : DBL_DIG; precision <= DBL_DECIMAL_DIG; precision++) {
+        len = snprintf(buff, sizeof(buff), "%.*g", precision, dec);
+        if (strtod(buff, NULL) == dec) break;
+    }
+    write_bytes(wr, buff, len);
+}
+
+static void write_string(json_writer* wr, const char* str) {
+    static const char hex[] = "0123456789abcdef";
+    write_char(wr, '"');
+    while (*str) {
+        // the run that needs no escapes is copied at once
+        const char* run = str;
+        while ((unsigned char) *str >= 32 && *str != '"' && *str != '\\') str++;
+        write_bytes(wr, run, str-run);
+        if (!*str) break;
+        char c = *str++;
+        char esc[6] = {'\\', c, 0, 0, 0, 0};
+        size_t len = 2;
+        switch (c) {
+            case '"': case '\\': break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
             default:
+                esc[1] = 'u';
+                esc[2] = esc[3] = '0';
+                esc[4] = hex[(c>>4) & 0xF];
+                esc[5] = hex[c & 0xF];
+                len = 6;
                 break;
         }
-        if (i!=meta.length-1) {
-            fprintf(fd, ",");
-        }
-        //printf(" | %d", temp.type);
-        fprintf(fd, "\n");
+        write_bytes(wr, esc, len);
     }
-    tabs--;
-    iter = tabs;
-    while (iter>0) {
-        fprintf(fd, "\t");
-        iter--;
-    } fprintf(fd, "]");
+    write_char(wr, '"');
 }
 
-void fprintchild(FILE *fd, json_child *child, size_t tabs) {
-    size_t iter;
+static void write_value(json_writer* wr, json_object* obj);
 
-    // iter = tabs;
-    // while (iter>0) {
-    //     printf("\t");
-    //     iter--;
-    // }  
-    fprintf(fd, "{\n");
+static void write_array(json_writer* wr, json_object* array) {
+    vector_metainfo meta = vec_meta(array);
+    write_char(wr, '[');
+    if (meta.length == 0) {
+        write_char(wr, ']');
+        return;
+    }
+    wr->depth++;
+    for (int i=0; i<meta.length; i++) {
+        if (i) write_char(wr, ',');
+        write_indent(wr);
+        write_value(wr, array+i);
+    }
+    wr->depth--;
+    write_indent(wr);
+    write_char(wr, ']');
+}
 
-    tabs++;
+static void write_child(json_writer* wr, json_child* child) {
     vector_metainfo meta = vec_meta(child->fields);
-    // printf("size %d\n", meta.length);
-    json_pair temp;
+    write_char(wr, '{');
+    if (meta.length == 0) {
+        write_char(wr, '}');
+        return;
+    }
+    wr->depth++;
     for (int i=0; i<meta.length; i++) {
-        temp = child->fields[i];
-        iter = tabs;
-        while (iter>0) {
-            fprintf(fd, "\t");
-            iter--;
-        } 
-        fprintf(fd, "\"%s\" : ", temp.key);
-        switch (temp.value.type) {
-            case STR:
-                fprintf(fd, "\"%s\"", temp.value.data.str);
-                break;
-            case INT:
-                fprintf(fd, "%d", temp.value.data.num);
-                break;
-            case FLOAT:
-                fprintf(fd, "%f", temp.value.data.dec);
-                break;
-            case CHILD:
-                fprintchild(fd, &temp.value.data.child, tabs);
-                break;
-            case ARRAY:
-                fprintarray(fd, temp.value.data.array, tabs+1);
-                break;
-
-            default:
-                break;
-        }
-        if (i!=meta.length-1) {
-            fprintf(fd, ",");
-        }
-        //printf(" | %d", temp.value.type);
-        fprintf(fd, "\n");
+        if (i) write_char(wr, ',');
+        write_indent(wr);
+        write_string(wr, child->fields[i].key);
+        if (wr->style == JSON_PRETTY) write_bytes(wr, " : ", 3);
+        else write_char(wr, ':');
+        write_value(wr, &child->fields[i].value);
+        if (wr->fd && wr->len >= JSON_WRITE_FLUSH) writer_flush(wr);
     }
-    tabs--;
-    iter = tabs;
-    while (iter>0) {
-        fprintf(fd, "\t");
-        iter--;
-    } fprintf(fd, "}");
-    if (tabs == 0) {
-        fprintf(fd, "\n");
+    wr->depth--;
+    write_indent(wr);
+    write_char(wr, '}');
+}
+
+static void write_value(json_writer* wr, json_object* obj) {
+    switch (obj->type) {
+        case STR:
+            write_string(wr, obj->data.str);
+            break;
+        case INT:
+            write_int(wr, obj->data.num);
+            break;
+        case FLOAT:
+            write_float(wr, obj->data.dec);
+            break;
+        case BOOL:
+            if (obj->data.boolean) write_bytes(wr, "true", 4);
+            else write_bytes(wr, "false", 5);
+            break;
+        case NIL:
+            write_bytes(wr, "null", 4);
+            break;
+        case CHILD:
+            write_child(wr, &obj->data.child);
+            break;
+        case ARRAY:
+            write_array(wr, obj->data.array);
+            break;
+        default:
+            break;
     }
 }
 
+static void writer_init(json_writer* wr, FILE* fd, json_style style) {
+    wr->fd = fd;
+    wr->style = style;
+    wr->depth = 0;
+    wr->failed = false;
+    wr->len = 0;
+    wr->capacity = JSON_WRITE_FLUSH*2;
+    wr->buffer = memloc(wr->capacity);
+}
+
+bool json_write(FILE* fd, json_child* child, json_style style) {
+    json_writer wr;
+    writer_init(&wr, fd, style);
+    write_child(&wr, child);
+    write_char(&wr, '\n');
+    bool result = writer_flush(&wr);
+    memfree(wr.buffer);
+    return result;
+}
+
+char* json_to_string(json_child* child, json_style style, size_t* len) {
+    json_writer wr;
+    writer_init(&wr, NULL, style);
+    write_child(&wr, child);
+    write_char(&wr, '\0');
+    *len = wr.len-1;
+    return wr.buffer;
+}
+
 void save_json(FILE* fd, json_child* child) {
-    fprintchild(fd, child, 0);
-}
\ No newline at end of file
+    json_write(fd, child, JSON_PRETTY);
+}
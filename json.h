@@ -1,6 +1,9 @@
 #ifndef s7k_json_lib
 #define s7k_json_lib
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "memmanager.h"
 #include "vector.h"
 
@@ -9,19 +12,29 @@ typedef enum  {
     INT,
     FLOAT,
     ARRAY,
-    CHILD
+    CHILD,
+    BOOL,
+    NIL // null
 } json_object_types; 
 
+// objects with this many fields get a hashed key index
+#define JSON_INDEX_MIN 16
+// arrays are split between threads in parts of at least this many bytes
+#define JSON_PART_MIN (256*1024)
+#define JSON_PARTS_MAX 64
+
 struct json_child_struct {
     struct json_pair_struct* fields; // vector
+    uint32_t* index; // NULL for small objects, index[0] is 0 until the first json_get()
     // struct json_child_struct* parent; // pointer
 };
 typedef struct json_child_struct json_child;
 
 typedef union {
     char* str;
-    int num;
-    float dec;
+    int64_t num;
+    double dec;
+    bool boolean;
     struct json_object_struct* array; //vector
     struct json_child_struct child;
 } json_data;
@@ -33,7 +46,8 @@ struct json_object_struct {
 typedef struct json_object_struct json_object;
 
 struct json_pair_struct {
-    char* key;
+    char* key; // equal keys of a document share one string
+    uint64_t hash;
     struct json_object_struct value;
 };
 typedef struct json_pair_struct json_pair;
@@ -43,24 +57,100 @@ typedef struct json_pair_struct json_pair;
 
 
 
-struct Token_struct {
-    char *start;
-    char *end;
-    struct Token_struct* parent;
-};
-typedef struct Token_struct Token;
+// set of interned keys, open addressing
+typedef struct json_keys {
+    char** slots;
+    size_t count, capacity;
+} json_keys;
+
+// object or array found by the prescan
+typedef struct json_container {
+    size_t count; // elements
+    size_t offset; // place in the arena
+    uint32_t open; // index of the opening bracket in the structurals
+    uint32_t after; // index of the first container after this one and its children
+    uint32_t element; // index in the parent container
+    bool object;
+} json_container;
+
+// position of the single pass parser
+typedef struct json_parser {
+    char *start, *ptr, *end;
+    bool failed;
+    uint32_t* structurals; // vector, positions found by jsonscan()
+    size_t cursor; // first structural not consumed by a string
+    json_container* containers; // vector, every container in document order
+    size_t container; // index of the next container in containers
+    char *arena_start, *arena; // free space for the next container
+    json_keys keys;
+    size_t threads; // large arrays are parsed in this many parts at most
+    bool part; // parsing a part of an array, keys are only looked up
+    bool missed; // a key of the part is not in keys
+} json_parser;
+
+// parsed file and the buffer its strings point into
+typedef struct json_document {
+    json_child root;
+    void* arena; // every object and array of the tree, in document order
+    char* data;
+    size_t size;
+    bool mapped;
+    json_keys keys; // every key of the tree, until json_close()
+} json_document;
 
 void init_json();
 
+// maps the file copy-on-write and parses it in place, strings and keys
+// point into the mapping until json_close()
+// @return false on a syntax error
+bool json_open(FILE* fd, json_document* doc);
+void json_close(json_document* doc);
+
+// @return parsed document, its fields are NULL on a syntax error
 json_child read_json(FILE* fd);
+// writes the document pretty-printed
 void save_json(FILE* fd, json_child* child);
 
-json_pair parse_pair(Token*);
-json_object read_object(char*, size_t);
-json_object *read_array(char*, size_t);
+// parses the document of size bytes at str, str[size] must be readable
+// @note objects and arrays of the result are full, vec_add() must not grow them
 json_child read_child(char*, size_t);
 
-void fprintchild(FILE *fd, json_child *child, size_t tabs);
-void fprintarray(FILE *fd, json_object *array, size_t tabs);
+// reads a number, integers that fit into 64 bits become INT, the rest FLOAT
+// @return end of the number, NULL if it is not one
+const char* json_parse_number(const char* ptr, const char* end, json_object* obj);
+
+// @return the interned string equal to key, NULL if there is none
+char* json_intern_find(json_keys* keys, const char* key, uint64_t hash);
+// adds key unless an equal key is there
+// @return the interned string equal to key
+char* json_intern(json_keys* keys, char* key, uint64_t hash);
+void json_keys_free(json_keys* keys);
+
+// @param key with a pointer from the keys of the document, found without strcmp()
+// @return value of key in child, NULL if there is none
+json_object* json_get(json_child* child, const char* key);
+
+typedef enum json_style {
+    JSON_COMPACT, // no whitespace at all
+    JSON_PRETTY // one value per line, indented with tabs
+} json_style;
+
+// output is collected in a buffer and written in pieces of this size
+#define JSON_WRITE_FLUSH 65536
+
+typedef struct json_writer {
+    FILE* fd; // NULL if the buffer is the result
+    char* buffer;
+    size_t len, capacity;
+    json_style style;
+    size_t depth;
+    bool failed;
+} json_writer;
+
+// @return false if writing to fd failed
+bool json_write(FILE* fd, json_child* child, json_style style);
+// @param len set to the length of the result
+// @return new string with the document, free it with memfree()
+char* json_to_string(json_child* child, json_style style, size_t* len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "jsonscan.h"
+
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSONSCAN_X86
+#endif
+
+// one bit per byte of a 64-byte block
+typedef struct block_masks {
+    uint64_t quote, backslash, op;
+} block_masks;
+
+typedef void(scan_block_type)(const char* block, block_masks* masks);
+
+static void scan_block_scalar(const char* block, block_masks* masks) {
+    masks->quote = masks->backslash = masks->op = 0;
+    for (int i=0; i<64; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+        switch (block[i]) {
+            case '"': masks->quote |= bit; break;
+            case '\\': masks->backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': masks->op |= bit; break;
+            default: break;
+        }
+    }
+}
+
+#if defined(JSONSCAN_X86)
+__attribute__((target("sse2")))
+static void scan_block_sse2(const char* block, block_masks* masks) {
+    masks->quote = masks->backslash = masks->op = 0;
+    for (int i=0; i<4; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i*) (block + i*16));
+        __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('{')), _mm_cmpeq_epi8(in, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('[')), _mm_cmpeq_epi8(in, _mm_set1_epi8(']'))));
+        op = _mm_or_si128(op,
+            _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(':')), _mm_cmpeq_epi8(in, _mm_set1_epi8(','))));
+        int shift = i*16;
+        masks->quote |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('"'))) << shift;
+        masks->backslash |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('\\'))) << shift;
+        masks->op |= (uint64_t) (uint16_t) _mm_movemask_epi8(op) << shift;
+    }
+}
+
+__attribute__((target("avx2")))
+static void scan_block_avx2(const char* block, block_masks* masks) {
+    masks->quote = masks->backslash = masks->op = 0;
+    for (int i=0; i<2; i++) {
+        __m256i in = _mm256_loadu_si256((const __m256i*) (block + i*32));
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8(']'))));
+        op = _mm256_or_si256(op,
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8(','))));
+        int shift = i*32;
+        masks->quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"'))) << shift;
+        masks->backslash |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))) << shift;
+        masks->op |= (uint64_t) (uint32_t) _mm256_movemask_epi8(op) << shift;
+    }
+}
+#endif
+
+scan_block_type* scan_block = NULL;
+const char* scan_kind = "scalar";
+
+static void pick_scanner() {
+    scan_block = scan_block_scalar;
+#if defined(JSONSCAN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_block = scan_block_avx2;
+        scan_kind = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_block = scan_block_sse2;
+        scan_kind = "sse2";
+    }
+#endif
+}
+
+const char* jsonscan_kind() {
+    if (!scan_block) pick_scanner();
+    return scan_kind;
+}
+
+// @return bits of characters escaped by a backslash, carries odd runs over blocks
+static uint64_t find_escaped(uint64_t backslash, uint64_t* prev_escaped) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    backslash &= ~*prev_escaped;
+    uint64_t follows_escape = backslash << 1 | *prev_escaped;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_starts = odd_starts + backslash;
+    *prev_escaped = even_starts < backslash; // carry out of the block
+    uint64_t invert = even_starts << 1;
+    return (even_bits ^ invert) & follows_escape;
+}
+
+// @return bits set from every opening quote up to its closing quote
+static uint64_t prefix_xor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+uint32_t* jsonscan(const char* data, size_t size) {
+    if (!scan_block) pick_scanner();
+    // a structural character for every 8 bytes is a typical density
+    uint32_t* positions = new_vec(sizeof(uint32_t), size/8 + STANDART_PREALLOC);
+    uint64_t prev_escaped = 0, prev_in_string = 0;
+    uint32_t found[64];
+    char tail[64];
+    block_masks masks;
+    for (size_t offset = 0; offset < size; offset += 64) {
+        const char* block = data + offset;
+        if (size - offset < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, size - offset);
+            block = tail;
+        }
+        scan_block(block, &masks);
+
+        uint64_t quote = masks.quote & ~find_escaped(masks.backslash, &prev_escaped);
+        uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
+        uint64_t structural = (masks.op & ~in_string) | quote;
+
+        size_t count = 0;
+        while (structural) {
+            found[count++] = offset + __builtin_ctzll(structural);
+            structural &= structural - 1;
+        }
+        if (count) positions = vec_extend(positions, found, count);
+    }
+    return positions;
+}
@@ -0,0 +1,18 @@
+#ifndef s7k_jsonscan_lib
+#define s7k_jsonscan_lib
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vector.h"
+
+// the first stage of the JSON parser: finds every quote that opens or
+// closes a string and every {}[]:, outside of strings, 64 bytes at a time
+
+// @return name of the block scanner picked for this CPU
+const char* jsonscan_kind();
+// @param size must be below 4 GB
+// @return vector of positions of structural characters in order
+uint32_t* jsonscan(const char* data, size_t size);
+
+#endif
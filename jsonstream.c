@@ -0,0 +1,407 @@
+#include "jsonstream.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "hash.h"
+
+#define JSON_POOL_BLOCK 65536
+
+typedef struct json_reader {
+    FILE* fd;
+    json_events* events;
+    char* buffer;
+    size_t pos, size;
+    size_t line;
+    bool failed;
+    char* text; // the current string or number
+    size_t text_len, text_capacity;
+} json_reader;
+
+static bool read_error(json_reader* rd, const char* msg) {
+    if (rd->failed) return false;
+    printf("JSON syntax error at line %zu: %s\n", rd->line, msg);
+    rd->failed = true;
+    return false;
+}
+
+// @return next character without taking it, EOF at the end
+static int peek(json_reader* rd) {
+    if (rd->pos == rd->size) {
+        rd->size = fread(rd->buffer, 1, JSON_STREAM_BUFFER, rd->fd);
+        rd->pos = 0;
+        if (rd->size == 0) return EOF;
+    }
+    return (unsigned char) rd->buffer[rd->pos];
+}
+
+static void text_add(json_reader* rd, const char* str, size_t len) {
+    if (rd->text_len + len + 1 > rd->text_capacity) {
+        size_t capacity = rd->text_capacity*2;
+        while (capacity < rd->text_len + len + 1) capacity *= 2;
+        char* text = memloc(capacity);
+        memcpy(text, rd->text, rd->text_len);
+        memfree(rd->text);
+        rd->text = text;
+        rd->text_capacity = capacity;
+    }
+    memcpy(rd->text + rd->text_len, str, len);
+    rd->text_len += len;
+}
+
+static void skip_spaces(json_reader* rd) {
+    int c;
+    while ((c = peek(rd)) == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        if (c == '\n') rd->line++;
+        rd->pos++;
+    }
+}
+
+static bool accept(json_reader* rd, char symb) {
+    skip_spaces(rd);
+    if (peek(rd) != symb) return false;
+    rd->pos++;
+    return true;
+}
+
+static int hex_digit(int c) {
+    if (c>='0' && c<='9') return c-'0';
+    if (c>='a' && c<='f') return c-'a'+10;
+    if (c>='A' && c<='F') return c-'A'+10;
+    return -1;
+}
+
+static long read_hex4(json_reader* rd) {
+    long code = 0;
+    for (int i=0; i<4; i++) {
+        int d = hex_digit(peek(rd));
+        if (d < 0) return -1;
+        rd->pos++;
+        code = code*16 + d;
+    }
+    return code;
+}
+
+static void add_utf8(json_reader* rd, long code) {
+    char out[4];
+    size_t len;
+    if (code < 0x80) {
+        out[0] = code;
+        len = 1;
+    } else if (code < 0x800) {
+        out[0] = 0xC0 | (code>>6);
+        out[1] = 0x80 | (code & 0x3F);
+        len = 2;
+    } else if (code < 0x10000) {
+        out[0] = 0xE0 | (code>>12);
+        out[1] = 0x80 | ((code>>6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        len = 3;
+    } else {
+        out[0] = 0xF0 | (code>>18);
+        out[1] = 0x80 | ((code>>12) & 0x3F);
+        out[2] = 0x80 | ((code>>6) & 0x3F);
+        out[3] = 0x80 | (code & 0x3F);
+        len = 4;
+    }
+    text_add(rd, out, len);
+}
+
+// reads a string after its opening quote into rd->text
+static bool read_string(json_reader* rd) {
+    rd->text_len = 0;
+    while (true) {
+        if (peek(rd) == EOF) return read_error(rd, "unterminated string");
+        // copy the run up to the next quote or escape at once
+        char* start = rd->buffer + rd->pos;
+        size_t len = 0;
+        while (rd->pos+len < rd->size && start[len] != '"' && start[len] != '\\') len++;
+        text_add(rd, start, len);
+        rd->pos += len;
+        if (rd->pos == rd->size) continue;
+
+        rd->pos++;
+        if (start[len] == '"') break;
+        char c = peek(rd);
+        rd->pos++;
+        switch (c) {
+            case '"': case '\\': case '/': text_add(rd, &c, 1); break;
+            case 'b': text_add(rd, "\b", 1); break;
+            case 'f': text_add(rd, "\f", 1); break;
+            case 'n': text_add(rd, "\n", 1); break;
+            case 'r': text_add(rd, "\r", 1); break;
+            case 't': text_add(rd, "\t", 1); break;
+            case 'u': {
+                long code = read_hex4(rd);
+                if (code >= 0xD800 && code < 0xDC00) {
+                    // the low half of a surrogate pair
+                    if (peek(rd) != '\\') return read_error(rd, "wrong escape sequence");
+                    rd->pos++;
+                    if (peek(rd) != 'u') return read_error(rd, "wrong escape sequence");
+                    rd->pos++;
+                    long low = read_hex4(rd);
+                    if (low < 0xDC00 || low >= 0xE000) return read_error(rd, "wrong escape sequence");
+                    code = 0x10000 + ((code-0xD800)<<10) + (low-0xDC00);
+                }
+                // a low half without the high one
+                if (code < 0 || (code >= 0xDC00 && code < 0xE000)) return read_error(rd, "wrong escape sequence");
+                add_utf8(rd, code);
+                break;
+            }
+            default:
+                return read_error(rd, "wrong escape sequence");
+        }
+    }
+    rd->text[rd->text_len] = '\0';
+    return true;
+}
+
+static bool read_number(json_reader* rd) {
+    json_object value;
+    int c;
+    rd->text_len = 0;
+    while ((c = peek(rd)) != EOF && ((c>='0' && c<='9') || c=='.' || c=='e' || c=='E' || c=='+' || c=='-')) {
+        char symb = c;
+        text_add(rd, &symb, 1);
+        rd->pos++;
+    }
+    rd->text[rd->text_len] = '\0';
+    const char* stop = json_parse_number(rd->text, rd->text + rd->text_len, &value);
+    if (!stop || stop != rd->text + rd->text_len) return read_error(rd, "wrong number");
+    if (rd->events->on_number && !rd->events->on_number(rd->events->user, &value)) return false;
+    return true;
+}
+
+// @return true and takes word if the input continues with it
+static bool read_word(json_reader* rd, const char* word) {
+    if (peek(rd) != word[0]) return false;
+    for (; *word; word++) {
+        if (peek(rd) != *word) return read_error(rd, "wrong literal");
+        rd->pos++;
+    }
+    return true;
+}
+
+#define EMIT(rd, event, ...) \
+    (!(rd)->events->event || (rd)->events->event((rd)->events->user, ##__VA_ARGS__))
+
+static bool stream_value(json_reader* rd);
+
+static bool stream_array(json_reader* rd) {
+    if (!EMIT(rd, begin_array)) return false;
+    if (!accept(rd, ']')) {
+        do {
+            if (!stream_value(rd)) return false;
+        } while (accept(rd, ','));
+        if (!accept(rd, ']')) return read_error(rd, "expected , or ]");
+    }
+    return EMIT(rd, end_array);
+}
+
+static bool stream_child(json_reader* rd) {
+    if (!EMIT(rd, begin_object)) return false;
+    if (!accept(rd, '}')) {
+        do {
+            if (!accept(rd, '"')) return read_error(rd, "expected key");
+            if (!read_string(rd)) return false;
+            if (!EMIT(rd, on_key, rd->text, rd->text_len)) return false;
+            if (!accept(rd, ':')) return read_error(rd, "expected :");
+            if (!stream_value(rd)) return false;
+        } while (accept(rd, ','));
+        if (!accept(rd, '}')) return read_error(rd, "expected , or }");
+    }
+    return EMIT(rd, end_object);
+}
+
+static bool stream_value(json_reader* rd) {
+    skip_spaces(rd);
+    int c = peek(rd);
+    switch (c) {
+        case EOF:
+            return read_error(rd, "unexpected end of file");
+        case '{':
+            rd->pos++;
+            return stream_child(rd);
+        case '[':
+            rd->pos++;
+            return stream_array(rd);
+        case '"':
+            rd->pos++;
+            return read_string(rd) && EMIT(rd, on_string, rd->text, rd->text_len);
+        default:
+            break;
+    }
+    if (c == 't' || c == 'f') {
+        if (!read_word(rd, (c == 't') ? "true" : "false")) return false;
+        return EMIT(rd, on_bool, c == 't');
+    }
+    if (c == 'n') return read_word(rd, "null") && EMIT(rd, on_null);
+    return read_number(rd);
+}
+
+bool json_stream(FILE* fd, json_events* events) {
+    json_reader rd;
+    rd.fd = fd;
+    rd.events = events;
+    rd.buffer = memloc(JSON_STREAM_BUFFER);
+    rd.pos = rd.size = 0;
+    rd.line = 1;
+    rd.failed = false;
+    rd.text_capacity = 256;
+    rd.text_len = 0;
+    rd.text = memloc(rd.text_capacity);
+
+    bool result;
+    if (!accept(&rd, '{')) {
+        result = read_error(&rd, "expected {");
+    } else {
+        result = stream_child(&rd);
+        skip_spaces(&rd);
+        if (result && peek(&rd) != EOF) result = read_error(&rd, "unexpected data after the end");
+    }
+    memfree(rd.buffer);
+    memfree(rd.text);
+    return result;
+}
+
+char* json_pool_copy(json_pool* pool, const char* str, size_t len) {
+    if (!pool->arena) pool->arena = arena_create(JSON_POOL_BLOCK);
+    char* copy = arena_alloc(pool->arena, len+1, 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void json_pool_free(json_pool* pool) {
+    arena_destroy(pool->arena);
+    pool->arena = NULL;
+}
+
+// adds a finished value to the innermost open container
+static void build_add(json_builder* bd, json_object* value) {
+    json_build_level* top = bd->stack + vec_meta(bd->stack).length-1;
+    if (top->value.type == ARRAY) {
+        top->value.data.array = vec_add(top->value.data.array, value);
+        return;
+    }
+    json_pair pair;
+    pair.key = top->key;
+    pair.hash = top->hash;
+    pair.value = *value;
+    top->value.data.child.fields = vec_add(top->value.data.child.fields, &pair);
+}
+
+static bool build_begin(json_builder* bd, json_object_types type) {
+    json_build_level level = {0};
+    level.value.type = type;
+    if (type == ARRAY) {
+        level.value.data.array = new_vec(sizeof(json_object), STANDART_PREALLOC);
+    } else {
+        level.value.data.child.fields = new_vec(sizeof(json_pair), STANDART_PREALLOC);
+        level.value.data.child.index = NULL;
+    }
+    if (!bd->stack) bd->stack = new_vec(sizeof(json_build_level), STANDART_PREALLOC);
+    bd->stack = vec_add(bd->stack, &level);
+    return true;
+}
+
+static bool build_end(void* user) {
+    json_builder* bd = user;
+    vector_metainfo* meta = vec_metaptr(bd->stack);
+    json_object value = bd->stack[--meta->length].value;
+    if (meta->length) build_add(bd, &value);
+    else bd->root = value.data.child;
+    return true;
+}
+
+static bool build_begin_object(void* user) {
+    return build_begin(user, CHILD);
+}
+
+static bool build_begin_array(void* user) {
+    return build_begin(user, ARRAY);
+}
+
+static bool build_key(void* user, const char* key, size_t len) {
+    json_builder* bd = user;
+    json_build_level* top = bd->stack + vec_meta(bd->stack).length-1;
+    top->hash = hash_string(key, HASH_SEED);
+    top->key = json_intern_find(&bd->keys, key, top->hash);
+    if (!top->key) top->key = json_intern(&bd->keys, json_pool_copy(&bd->pool, key, len), top->hash);
+    return true;
+}
+
+static bool build_string(void* user, const char* str, size_t len) {
+    json_builder* bd = user;
+    json_object value;
+    value.type = STR;
+    value.data.str = json_pool_copy(&bd->pool, str, len);
+    build_add(bd, &value);
+    return true;
+}
+
+static bool build_number(void* user, json_object* value) {
+    build_add(user, value);
+    return true;
+}
+
+static bool build_bool(void* user, bool boolean) {
+    json_object value;
+    value.type = BOOL;
+    value.data.boolean = boolean;
+    build_add(user, &value);
+    return true;
+}
+
+static bool build_null(void* user) {
+    json_object value;
+    value.type = NIL;
+    build_add(user, &value);
+    return true;
+}
+
+json_events json_builder_events(json_builder* builder) {
+    json_events events;
+    events.user = builder;
+    events.begin_object = build_begin_object;
+    events.end_object = build_end;
+    events.begin_array = build_begin_array;
+    events.end_array = build_end;
+    events.on_key = build_key;
+    events.on_string = build_string;
+    events.on_number = build_number;
+    events.on_bool = build_bool;
+    events.on_null = build_null;
+    return events;
+}
+
+void json_free_object(json_object* obj) {
+    vector_metainfo meta;
+    if (obj->type == ARRAY) {
+        meta = vec_meta(obj->data.array);
+        for (int i=0; i<meta.length; i++) json_free_object(obj->data.array+i);
+        delete_vec(obj->data.array);
+    } else if (obj->type == CHILD) {
+        meta = vec_meta(obj->data.child.fields);
+        for (int i=0; i<meta.length; i++) json_free_object(&obj->data.child.fields[i].value);
+        delete_vec(obj->data.child.fields);
+    }
+}
+
+void json_builder_free(json_builder* builder) {
+    if (builder->stack) {
+        // containers left open by an error
+        vector_metainfo meta = vec_meta(builder->stack);
+        for (int i=0; i<meta.length; i++) json_free_object(&builder->stack[i].value);
+        delete_vec(builder->stack);
+    }
+    if (builder->root.fields) {
+        json_object root;
+        root.type = CHILD;
+        root.data.child = builder->root;
+        json_free_object(&root);
+    }
+    json_keys_free(&builder->keys);
+    json_pool_free(&builder->pool);
+    memset(builder, 0, sizeof(json_builder));
+}
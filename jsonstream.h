@@ -0,0 +1,64 @@
+#ifndef s7k_jsonstream_lib
+#define s7k_jsonstream_lib
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "json.h"
+
+// bytes read from the file at once
+#define JSON_STREAM_BUFFER 65536
+
+// callbacks of json_stream(), any of them may be NULL
+// @note strings are only valid during the call
+// @return false to stop reading
+typedef struct json_events {
+    void* user;
+    bool (*begin_object)(void* user);
+    bool (*end_object)(void* user);
+    bool (*begin_array)(void* user);
+    bool (*end_array)(void* user);
+    bool (*on_key)(void* user, const char* key, size_t len);
+    bool (*on_string)(void* user, const char* str, size_t len);
+    // value is INT or FLOAT
+    bool (*on_number)(void* user, json_object* value);
+    bool (*on_bool)(void* user, bool value);
+    bool (*on_null)(void* user);
+} json_events;
+
+// reads a document from fd in pieces of JSON_STREAM_BUFFER bytes
+// @return false on a syntax error or if a callback stopped it
+bool json_stream(FILE* fd, json_events* events);
+
+// strings copied into an arena, freed all at once
+typedef struct json_pool {
+    Arena* arena; // NULL until the first copy
+} json_pool;
+
+char* json_pool_copy(json_pool* pool, const char* str, size_t len);
+void json_pool_free(json_pool* pool);
+
+typedef struct json_build_level {
+    json_object value; // CHILD or ARRAY being built
+    char* key; // key of the next value of an object
+    uint64_t hash;
+} json_build_level;
+
+// builds a tree from the events of json_stream(), containers are growable
+// vectors, strings and keys live in the pool
+typedef struct json_builder {
+    json_build_level* stack; // vector, the open containers
+    json_child root;
+    json_keys keys;
+    json_pool pool;
+} json_builder;
+
+// @return events that build the tree into builder->root
+json_events json_builder_events(json_builder* builder);
+// frees the tree and its strings
+void json_builder_free(json_builder* builder);
+// frees the containers of obj, but not its strings
+void json_free_object(json_object* obj);
+
+#endif
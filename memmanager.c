@@ -1,20 +1,41 @@
 #include "memmanager.h"
 
+#include <string.h>
+
+#if !defined(WIN32)
+#include <pthread.h>
+#endif
+
 allocator_func_type *cool_allocator = malloc;
 deallocator_func_type *cool_deallocator = free;
 
+// the page list and the heap list are shared, slab allocations are not
 Page *start_page = NULL;
+Heap *heaps = NULL;
+static atomic_flag pages_lock = ATOMIC_FLAG_INIT;
+static _Thread_local Heap* local_heap;
+
+static void lock_pages() {
+    while (atomic_flag_test_and_set_explicit(&pages_lock, memory_order_acquire));
+}
+
+static void unlock_pages() {
+    atomic_flag_clear_explicit(&pages_lock, memory_order_release);
+}
 
 void init_allocator(allocator_func_type alloc, deallocator_func_type dealloc) {
     if (alloc && dealloc) {cool_allocator = alloc; cool_deallocator = dealloc;}
 }
 
-Chunk* new_chunk(void* start, void* end) {
+Chunk* new_chunk(Page* page, void* start, void* end) {
     if (end-start <= sizeof(Chunk)) exit(1);
     Chunk *ptr = (Chunk*) start;
     //ptr->start = start;
     ptr->end = end;
     ptr->next = NULL;
+    ptr->prev = NULL;
+    ptr->check = (uintptr_t) page ^ HEADER_MAGIC;
+    ptr->page = page;
     return ptr;
 }
 
@@ -32,7 +53,7 @@ void* try_allocate(Page* page, size_t size) {
     size_t remain_cap = page->capacity;
     Chunk* ptr1 = page->chunk_chain;
     if (!ptr1) {
-        page->chunk_chain = new_chunk(page->pointer, page->pointer+size);
+        page->chunk_chain = new_chunk(page, page->pointer, page->pointer+size);
         page->size -= size;
         return chunk_data(page->chunk_chain);
     }
@@ -41,10 +62,10 @@ void* try_allocate(Page* page, size_t size) {
     while (ptr2 != NULL) {
         diff = chunk_diff(ptr2, ptr1->end);
         if (diff >= size) {
-            temp = new_chunk(ptr1->end, ptr1->end+size);
+            temp = new_chunk(page, ptr1->end, ptr1->end+size);
             ptr1->next = temp;
-            //temp->prev = ptr1;
-            //ptr2->prev = temp; 
+            temp->prev = ptr1;
+            ptr2->prev = temp;
             temp->next = ptr2;
             page->size -= size;
             return chunk_data(temp);
@@ -57,8 +78,9 @@ void* try_allocate(Page* page, size_t size) {
     void* end = page->pointer + page->capacity;
     diff = end - ptr1->end;
     if (diff >= size) {
-        temp = new_chunk(ptr1->end, ptr1->end+size);
-        ptr1->next = temp; //temp->prev = ptr1;
+        temp = new_chunk(page, ptr1->end, ptr1->end+size);
+        ptr1->next = temp;
+        temp->prev = ptr1;
         page->size -= size;
         return chunk_data(temp);
     }
@@ -66,128 +88,257 @@ void* try_allocate(Page* page, size_t size) {
     return NULL;
 }
 
+// @return size rounded up to MEM_ALIGN
+static size_t align_size(size_t size) {
+    return (size + MEM_ALIGN-1) & ~(size_t) (MEM_ALIGN-1);
+}
+
 Page* new_page(size_t size) {
     Page *ptr;
-    ptr = cool_allocator(sizeof(Page) + size);
+    ptr = cool_allocator(sizeof(Page) + MEM_ALIGN + size);
     ptr->prev = NULL; ptr->next = NULL;
     ptr->chunk_chain = NULL;
-    ptr->pointer = (void*) (ptr+1);
+    ptr->pointer = (void*) align_size((size_t) (ptr+1));
     ptr->size = size; ptr->capacity = size;
+    ptr->size_class = -1;
+    ptr->heap = NULL;
+    ptr->single = 0;
     return ptr;
 }
 
-void *memloc(size_t size) {
-    if (size == 0) return NULL;
-    size += sizeof(Chunk);
-    size_t pagesize = (size > PAGE_SIZE) ? size : PAGE_SIZE;
-    if (start_page==NULL) {
-        start_page = new_page(pagesize);
+// puts the page in front of the page list
+static void link_page(Page* page) {
+    lock_pages();
+    page->prev = NULL;
+    page->next = start_page;
+    if (start_page) start_page->prev = page;
+    start_page = page;
+    unlock_pages();
+}
+
+static void unlink_page(Page* page) {
+    lock_pages();
+    if (page->prev) page->prev->next = page->next;
+    else start_page = page->next;
+    if (page->next) page->next->prev = page->prev;
+    unlock_pages();
+}
+
+#if !defined(WIN32)
+static pthread_key_t heap_key;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+// the heap of a finished thread is taken by the next new one
+static void abandon_heap(void* heap) {
+    lock_pages();
+    ((Heap*) heap)->owned = 0;
+    unlock_pages();
+}
+
+static void init_heap_key() {
+    pthread_key_create(&heap_key, abandon_heap);
+}
+#endif
+
+// @return heap of the calling thread
+static Heap* thread_heap() {
+    if (local_heap) return local_heap;
+    lock_pages();
+    Heap* heap = heaps;
+    while (heap && heap->owned) heap = heap->next;
+    if (!heap) {
+        heap = cool_allocator(sizeof(Heap));
+        for (int i=0; i<SLAB_CLASSES; i++) heap->free_slots[i] = NULL;
+        atomic_init(&heap->remote, NULL);
+        heap->next = heaps;
+        heaps = heap;
     }
-    Page* ptr = start_page;
-    void* result;
-    while (ptr->next!=NULL) {
-        if (ptr->size >= size) {
-            result = try_allocate(ptr, size);
-            if (result) return result;
-        }
-        ptr = ptr->next;
+    heap->owned = 1;
+    unlock_pages();
+#if !defined(WIN32)
+    pthread_once(&heap_once, init_heap_key);
+    pthread_setspecific(heap_key, heap);
+#endif
+    local_heap = heap;
+    return heap;
+}
+
+// moves the slots freed by other threads to the free lists
+static void collect_remote(Heap* heap) {
+    Slot* slot = atomic_exchange(&heap->remote, NULL);
+    while (slot) {
+        Slot* next = slot->next;
+        int index = slot->page->size_class;
+        slot->page->size += sizeof(Slot) + class_size(index);
+        slot->next = heap->free_slots[index];
+        heap->free_slots[index] = slot;
+        slot = next;
     }
-    if (ptr->size >= size) {
-        result = try_allocate(ptr, size);
-        if (result) return result;
+}
+
+// 16 byte steps up to 128, then four classes for every doubling
+int size_class(size_t size) {
+    if (size <= 128) return (size+15)/16 - 1;
+    int shift = 63 - __builtin_clzll(size-1);
+    return 8 + (shift-7)*4 + ((size-1) >> (shift-2)) - 4;
+}
+
+size_t class_size(int size_class) {
+    if (size_class < 8) return (size_class+1)*16;
+    int shift = 7 + (size_class-8)/4;
+    return ((size_t) 1 << shift) + ((size_class-8)%4 + 1)*((size_t) 1 << (shift-2));
+}
+
+// carves a new slab page into free slots of the class
+static void new_slab(Heap* heap, int size_class) {
+    size_t stride = sizeof(Slot) + class_size(size_class);
+    Page* page = new_page(SLAB_PAGE_SIZE);
+    page->size_class = size_class;
+    page->heap = heap;
+    link_page(page);
+    size_t count = page->capacity / stride;
+    for (size_t i=count; i>0; i--) {
+        Slot* slot = (Slot*) ((char*) page->pointer + (i-1)*stride);
+        slot->page = page;
+        slot->next = heap->free_slots[size_class];
+        heap->free_slots[size_class] = slot;
     }
-    ptr->next = new_page(pagesize);
-    ptr->next->prev = ptr;
-    result = try_allocate(ptr->next, size);
-    return result;
 }
 
-void *memnew(size_t size) {
+void *memloc(size_t size) {
     if (size == 0) return NULL;
-    size += sizeof(Chunk);
-    Page* ptr;
-    void* result;
-    if (start_page==NULL) {
-        start_page = new_page(size);
-    }
-    ptr = start_page;
-    while (ptr->next != NULL) {
-        ptr = ptr->next;
-    }
-    ptr->next = new_page(size);
-    ptr->next->prev = ptr;
-    result = try_allocate(ptr->next, size);
-    return result;
+    if (size > SLAB_MAX) return memnew(size);
+    Heap* heap = thread_heap();
+    int index = size_class(size);
+    if (!heap->free_slots[index]) collect_remote(heap);
+    if (!heap->free_slots[index]) new_slab(heap, index);
+    Slot* slot = heap->free_slots[index];
+    heap->free_slots[index] = slot->next;
+    slot->check = (uintptr_t) slot->page ^ HEADER_MAGIC;
+    slot->page->size -= sizeof(Slot) + class_size(index);
+    return slot+1;
 }
 
-void prealloc(size_t size) {
-    if (size <= sizeof(Chunk)) size = PAGE_SIZE;
+// the page is rounded up to whole PAGE_SIZEs, memrealloc() grows into the rest
+void *memnew(size_t size) {
+    if (size == 0) return NULL;
+    size = align_size(size + sizeof(Chunk));
+    Page* ptr = new_page((size + PAGE_SIZE-1) / PAGE_SIZE * PAGE_SIZE);
+    ptr->single = 1;
+    link_page(ptr);
+    return try_allocate(ptr, size);
+}
 
-    if (start_page==NULL) {
-        start_page = new_page(size);
-    } else {
-        start_page->prev = new_page(size);
-        start_page->prev->next = start_page;
-        start_page = start_page->prev;
-    }
+// @return page of an allocation of memloc(), NULL for any other pointer
+static Page* owner_page(void* data) {
+    // check and page are the last two fields of both Chunk and Slot
+    uintptr_t* header = (uintptr_t*) data - 2;
+    Page* page = (Page*) header[1];
+    if (header[0] != ((uintptr_t) page ^ HEADER_MAGIC)) return NULL;
+    if (data < page->pointer || data >= page->pointer + page->capacity) return NULL;
+    return page;
 }
 
-void prealloc_end(size_t size) {
-    if (size <= sizeof(Chunk)) size = PAGE_SIZE;
+void *memloc_aligned(size_t size, size_t align) {
+    if (align <= MEM_ALIGN) return memloc(size);
+    if (size == 0) return NULL;
+    // a page of its own with room to move the chunk to the alignment
+    size_t chunk = align_size(size + sizeof(Chunk));
+    Page* page = new_page(chunk + align);
+    page->single = 1;
+    link_page(page);
+    char* data = (char*) page->pointer + sizeof(Chunk);
+    data += (align - (size_t) data % align) % align;
+    page->chunk_chain = new_chunk(page, data - sizeof(Chunk), data - sizeof(Chunk) + chunk);
+    page->size -= chunk;
+    return data;
+}
 
-    if (start_page==NULL) {
-        start_page = new_page(size);
+void *memrealloc(void *data, size_t size) {
+    if (!data) return memloc(size);
+    if (size == 0) {
+        memfree(data);
+        return NULL;
+    }
+    Page* page = owner_page(data);
+    // the size of other blocks is unknown, the caller has to move them
+    if (!page) return NULL;
+    size_t old;
+    if (page->size_class >= 0) {
+        // the rest of the slot
+        old = class_size(page->size_class);
+        if (size <= old) return data;
     } else {
-        Page* ptr = start_page;
-        while (ptr->next != NULL) {
-            ptr = ptr->next;
+        Chunk* chunk = (Chunk*) data - 1;
+        old = (char*) chunk->end - (char*) data;
+        if (size <= old) return data;
+        // the gap up to the next chunk or the end of the page
+        char* limit = (chunk->next) ? (char*) chunk->next : (char*) page->pointer + page->capacity;
+        size_t grown = align_size(size + sizeof(Chunk));
+        if ((char*) chunk + grown <= limit) {
+            page->size -= grown - chunk_diff(chunk->end, chunk);
+            chunk->end = (char*) chunk + grown;
+            return data;
         }
-        ptr->next = new_page(size);
-        ptr->next->prev = ptr;
     }
+    void* moved = memloc(size);
+    memcpy(moved, data, old);
+    memfree(data);
+    return moved;
 }
 
 void chunkfree(Page* page, void* pointer) {
-    Chunk* ptr = page->chunk_chain;
-    Chunk* prv = NULL;
-    while (ptr != NULL) {
-        if (pointer == chunk_data(ptr)) {
-            if (prv) prv->next = ptr->next;
-            else page->chunk_chain = ptr->next;
-
-            page->size += chunk_diff(ptr->end, ptr);
-            return;
-        }
-        prv = ptr;
-        ptr = ptr->next;
-    }
-    //no such adress or wrongly selected
+    Chunk* ptr = (Chunk*) pointer - 1;
+    ptr->check = 0;
+    if (ptr->prev) ptr->prev->next = ptr->next;
+    else page->chunk_chain = ptr->next;
+    if (ptr->next) ptr->next->prev = ptr->prev;
+
+    page->size += chunk_diff(ptr->end, ptr);
 }
 
 void memfree(void *data) {
-    Page* ptr = start_page;
-    void *start, *end;
-    while (ptr != NULL) {
-        start = ptr->pointer;
-        end = ptr->pointer + ptr->capacity;
-        if (data >= start && data < end) {
-            chunkfree(ptr, data);
+    if (!data) return;
+    // the header of the chunk knows its page
+    Page* page = owner_page(data);
+    if (!page) return; //no such adress in use
+    if (page->size_class >= 0) {
+        Slot* slot = (Slot*) data - 1;
+        Heap* heap = page->heap;
+        if (heap == local_heap) {
+            slot->next = heap->free_slots[page->size_class];
+            heap->free_slots[page->size_class] = slot;
+            page->size += sizeof(Slot) + class_size(page->size_class);
             return;
         }
-        ptr = ptr->next;
+        // lock-free push, only the owner takes slots off
+        slot->next = atomic_load(&heap->remote);
+        while (!atomic_compare_exchange_weak(&heap->remote, &slot->next, slot));
+        return;
+    }
+    chunkfree(page, data);
+    if (page->single && !page->chunk_chain) {
+        unlink_page(page);
+        cool_deallocator(page);
     }
-    //no such adress in use
 }
 
+// no other thread may allocate meanwhile
 void destroy_pages() {
+    lock_pages();
+    for (Heap* heap = heaps; heap; heap = heap->next) {
+        for (int i=0; i<SLAB_CLASSES; i++) heap->free_slots[i] = NULL;
+        atomic_store(&heap->remote, NULL);
+    }
     Page* pageptr = start_page;
-    if (!start_page) return;
+    start_page = NULL;
+    unlock_pages();
+    if (!pageptr) return;
     while (pageptr->next != NULL) {
         pageptr = pageptr->next;
         cool_deallocator(pageptr->prev);
     }
     cool_deallocator(pageptr);
-    start_page = NULL;
 }
 
 void programm_end() {
@@ -195,6 +346,57 @@ void programm_end() {
 }
 
 
+Arena* arena_create(size_t page_size) {
+    Arena* arena = cool_allocator(sizeof(Arena));
+    arena->pages = NULL;
+    arena->page_size = (page_size > PAGE_SIZE) ? page_size : PAGE_SIZE;
+    return arena;
+}
+
+void* arena_alloc(Arena* arena, size_t size, size_t align) {
+    if (align == 0) align = 1;
+    Page* page = arena->pages;
+    if (page) {
+        char* ptr = (char*) page->pointer + page->capacity - page->size;
+        size_t pad = (align - (size_t) ptr % align) % align;
+        if (pad + size <= page->size) {
+            page->size -= pad + size;
+            return ptr + pad;
+        }
+    }
+    size_t capacity = (size + align > arena->page_size) ? size + align : arena->page_size;
+    page = new_page(capacity);
+    page->next = arena->pages;
+    arena->pages = page;
+    char* ptr = page->pointer;
+    size_t pad = (align - (size_t) ptr % align) % align;
+    page->size -= pad + size;
+    return ptr + pad;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+    ArenaMark mark;
+    mark.page = arena->pages;
+    mark.size = (mark.page) ? mark.page->size : 0;
+    return mark;
+}
+
+void arena_reset_to(Arena* arena, ArenaMark mark) {
+    while (arena->pages && arena->pages != mark.page) {
+        Page* next = arena->pages->next;
+        cool_deallocator(arena->pages);
+        arena->pages = next;
+    }
+    if (arena->pages) arena->pages->size = mark.size;
+}
+
+void arena_destroy(Arena* arena) {
+    if (!arena) return;
+    ArenaMark empty = {NULL, 0};
+    arena_reset_to(arena, empty);
+    cool_deallocator(arena);
+}
+
 void page_info(short chunk_info) {
     Page* ptr;
     Chunk* ch;
@@ -204,7 +406,9 @@ void page_info(short chunk_info) {
     printf("\n\n--------\n");
     while (ptr!=NULL){
         total = total + (size_t)(ptr->capacity - ptr->size);
-        printf("%d: %ld/%ld (%ld used)\n", i, ptr->size, ptr->capacity, ptr->capacity - ptr->size);
+        printf("%d: %ld/%ld (%ld used)", i, ptr->size, ptr->capacity, ptr->capacity - ptr->size);
+        if (ptr->size_class >= 0) printf(" slots of %ld", class_size(ptr->size_class));
+        printf("\n");
         if (chunk_info) {
             ch = ptr->chunk_chain;
             while (ch != NULL) {
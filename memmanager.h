@@ -3,23 +3,78 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #define PAGE_SIZE 4096
+// every allocation of memloc() is aligned to this
+#define MEM_ALIGN 16
+// requests up to this size are served from slab pages of their size class
+#define SLAB_MAX 2048
+#define SLAB_CLASSES 24
+#define SLAB_PAGE_SIZE (64*1024)
+// check of a header is the adress of its page xor this
+#define HEADER_MAGIC ((uintptr_t) 0x6d656d6c6f63c0deULL)
+// zeroed bytes in front of the vectors carved out of one memloc() block,
+// the first of them would pass for a memloc() allocation of its own otherwise
+#define MEM_FROZEN_PAD MEM_ALIGN
 
+// header in front of larger allocations, chunks of a page are chained by adress
+// check and page are always the last fields, right in front of the data
 struct Chunk_struct {
     void* end; // points to adress AFTER the chunk
-    struct Chunk_struct *next;
+    struct Chunk_struct *next, *prev;
+    void* unused; // keeps the header a multiple of MEM_ALIGN
+    uintptr_t check; // tells allocations of memloc() from other pointers
+    struct Page_struct *page; // owner, memfree() needs no search
 };
 typedef struct Chunk_struct Chunk;
 
+// header in front of allocations from a slab page
+struct Slot_struct {
+    union {
+        struct Slot_struct *next; // in the free list of the size class
+        uintptr_t check; // while allocated, as in Chunk
+    };
+    struct Page_struct *page;
+};
+typedef struct Slot_struct Slot;
+
+// allocation state of a thread, slab pages belong to one heap
+// and other threads give their slots back through remote
+struct Heap_struct {
+    Slot* free_slots[SLAB_CLASSES]; // only used by the owner
+    _Atomic(Slot*) remote; // freed by other threads, taken over by the owner
+    int owned; // a running thread uses it, taken by a new thread otherwise
+    struct Heap_struct* next;
+};
+typedef struct Heap_struct Heap;
+
 struct Page_struct {
     void* pointer;
     size_t size, capacity;
     Chunk* chunk_chain;
     struct Page_struct *next, *prev;
+    int size_class; // -1 for pages of chunks
+    Heap* heap; // owner of a slab page
+    short single; // made by memnew(), released with its chunk
 };
 typedef struct Page_struct Page;
 
+// pages outside the page list, allocations are bumped and freed all at once
+// independent arenas can be used from different threads
+struct Arena_struct {
+    Page* pages; // the newest first, linked by next
+    size_t page_size;
+};
+typedef struct Arena_struct Arena;
+
+// position of an arena to reset it to
+typedef struct {
+    Page* page;
+    size_t size; // free bytes of the page
+} ArenaMark;
+
 typedef void*(allocator_func_type)(size_t);
 extern allocator_func_type *cool_allocator;
 
@@ -30,17 +85,35 @@ extern deallocator_func_type *cool_deallocator;
 void init_allocator(allocator_func_type alloc, deallocator_func_type dealloc);
 void *memloc(size_t size);
 void *memnew(size_t size);
+// @param align power of two
+void *memloc_aligned(size_t size, size_t align);
+// grows the chunk in place if the space after it is free, moves it otherwise
+// @note alignment above MEM_ALIGN is lost when the chunk moves
+// @return NULL and ptr untouched if memloc() did not return ptr
+void *memrealloc(void *ptr, size_t size);
+// pointers that memloc() did not return are ignored,
+// the 16 bytes in front of them must be readable
 void memfree(void *ptr);
-void prealloc(size_t size);
-void prealloc_end(size_t size);
 void programm_end();
 
 void page_info(short chunk_info);
 
+// @param page_size capacity of the pages, larger allocations get their own
+Arena* arena_create(size_t page_size);
+// @param align power of two, 0 for none
+void* arena_alloc(Arena* arena, size_t size, size_t align);
+ArenaMark arena_mark(Arena* arena);
+// frees everything allocated after the mark
+void arena_reset_to(Arena* arena, ArenaMark mark);
+void arena_destroy(Arena* arena);
+
 void* try_allocate(Page* page, size_t size);
 Page* new_page(size_t size);
 
-Chunk* new_chunk(void* start, void* end);
+Chunk* new_chunk(Page* page, void* start, void* end);
+// @return index of the smallest size class holding size bytes
+int size_class(size_t size);
+size_t class_size(int size_class);
 void chunkfree(Page* page, void* pointer);
 void destroy_pages();
 
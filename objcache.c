@@ -0,0 +1,376 @@
+#include "objcache.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "buildlog.h"
+#include "depfile.h"
+#include "process.h"
+
+#define COPY_BUFFER_SIZE 65536
+#define OBJCACHE_PATH_SIZE 512
+#define OBJCACHE_SIZE_FILE "size"
+
+char* objcache_dir = NULL;
+uint64_t objcache_limit = OBJCACHE_DEFAULT_LIMIT;
+bool objcache_direct = false;
+objcache_stats objcache_counters = {0};
+
+// compilers already looked up in PATH this run
+typedef struct compiler_identity {
+    char* name;
+    uint64_t hash;
+} compiler_identity;
+compiler_identity* identities = NULL; // vector
+
+int64_t cache_size = -1; // -1 until the size file is read
+int64_t cache_added = 0;
+
+static bool make_dir(const char* path) {
+#if defined(WIN32)
+    return mkdir(path)==0;
+#else
+    return mkdir(path, 0777)==0;
+#endif
+}
+
+// a truncated path would name another cache entry
+// @return false if the path does not fit into buff
+static bool format_path(char* buff, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buff, size, format, args);
+    va_end(args);
+    return len >= 0 && (size_t) len < size;
+}
+
+// @param suffix ".o", ".d" or ".m"
+static bool entry_path(uint64_t key, const char* suffix, char* buff, size_t size) {
+    return format_path(buff, size, "%s/%02x/%016llx%s", objcache_dir, (unsigned)(key >> 56),
+        (unsigned long long) key, suffix);
+}
+
+static bool copy_file(const char* from, const char* to) {
+    char temp[OBJCACHE_PATH_SIZE];
+    if (!format_path(temp, sizeof(temp), "%s.%ld.tmp", to, (long) getpid())) return false;
+    FILE* in = fopen(from, "rb");
+    if (!in) return false;
+    FILE* out = fopen(temp, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+    char* buff = memloc(COPY_BUFFER_SIZE);
+    size_t got;
+    bool result = true;
+    while ((got = fread(buff, 1, COPY_BUFFER_SIZE, in)) > 0) {
+        if (fwrite(buff, 1, got, out) != got) {
+            result = false;
+            break;
+        }
+    }
+    memfree(buff);
+    fclose(in);
+    result &= fclose(out)==0;
+#if defined(WIN32)
+    if (result) remove(to);
+#endif
+    if (result) result = rename(temp, to)==0;
+    if (!result) remove(temp);
+    return result;
+}
+
+// hard link shares the inode with the cache, the compiler never writes into it
+// because build.c removes the object before compiling
+static bool link_or_copy(const char* from, const char* to) {
+    remove(to);
+#if !defined(WIN32)
+    if (link(from, to)==0) return true;
+#endif
+    return copy_file(from, to);
+}
+
+// resolved path of the executable found in PATH, or name itself
+// @return false if name does not fit into buff
+static bool find_in_path(const char* name, char* buff, size_t size) {
+    if (!format_path(buff, size, "%s", name)) return false;
+    if (strchr(name, '/')) return true;
+    const char* path = getenv("PATH");
+    while (path && *path) {
+        const char* end = strchr(path, ':');
+        size_t len = (end) ? (size_t)(end-path) : strlen(path);
+        if (format_path(buff, size, "%.*s/%s", (int) len, path, name) && access(buff, X_OK)==0) return true;
+        path += len + ((end) ? 1 : 0);
+    }
+    return format_path(buff, size, "%s", name);
+}
+
+// compiler is identified by its resolved path, size and mtime
+static uint64_t compiler_hash(const char* name) {
+    if (!identities) identities = new_vec(sizeof(compiler_identity), STANDART_PREALLOC);
+    vector_metainfo meta = vec_meta(identities);
+    for (int i=0; i<meta.length; i++) {
+        if (strcmp(identities[i].name, name)==0) return identities[i].hash;
+    }
+
+    char buff[OBJCACHE_PATH_SIZE];
+    const char* path = (find_in_path(name, buff, sizeof(buff))) ? buff : name;
+    file_stat* st = stat_path(path);
+    uint64_t hash = hash_string(path, HASH_SEED);
+    hash = hash_bytes(&st->size, sizeof(st->size), hash);
+    hash = hash_bytes(&st->mtime, sizeof(st->mtime), hash);
+
+    compiler_identity id;
+    id.name = memloc(strlen(name)+1);
+    strcpy(id.name, name);
+    id.hash = hash;
+    identities = vec_add(identities, &id);
+    return hash;
+}
+
+uint64_t objcache_base(char** args) {
+    size_t count = args_count(args);
+    uint64_t hash = compiler_hash(args[0]);
+    for (size_t i=1; i<count; i++) {
+        // output paths do not change the object
+        if (strcmp(args[i], "-o")==0 || strcmp(args[i], "-MF")==0) {
+            i++;
+            continue;
+        }
+        hash = hash_string(args[i], hash);
+        hash = hash_bytes("", 1, hash);
+    }
+    return hash;
+}
+
+static uint64_t combine(uint64_t a, uint64_t b) {
+    uint64_t parts[2] = {a, b};
+    return hash_xxh64(parts, sizeof(parts), 0);
+}
+
+uint64_t objcache_key_preprocessed(uint64_t base, const char* ifile) {
+    uint64_t content;
+    if (!hash_file(ifile, &content)) return 0;
+    return combine(base, content);
+}
+
+uint64_t objcache_key_source(uint64_t base, const char* source) {
+    return combine(base, stat_content(stat_path(source)));
+}
+
+// direct mode: the manifest of the source key lists headers seen by the compiler
+// @return key of the object, 0 if there is no manifest
+static uint64_t manifest_key(uint64_t key) {
+    char buff[OBJCACHE_PATH_SIZE];
+    depfile dep;
+    if (!entry_path(key, ".m", buff, sizeof(buff)) || !depfile_read(buff, &dep)) return 0;
+    vector_metainfo meta = vec_meta(dep.deps);
+    for (int i=0; i<meta.length; i++) {
+        file_stat* st = stat_path(dep.deps[i]);
+        if (!st->exists) {
+            key = 0;
+            break;
+        }
+        key = combine(key, stat_content(st));
+    }
+    depfile_free(&dep);
+    return key;
+}
+
+bool objcache_fetch(uint64_t key, const char* object, const char* depfile) {
+    char buff[OBJCACHE_PATH_SIZE];
+    if (key && objcache_direct) key = manifest_key(key);
+    if (!key) {
+        objcache_counters.misses++;
+        return false;
+    }
+
+    if (!entry_path(key, ".d", buff, sizeof(buff)) || access(buff, R_OK)!=0 || !copy_file(buff, depfile)) {
+        objcache_counters.misses++;
+        return false;
+    }
+    // last use for eviction
+    utime(buff, NULL);
+
+    if (!entry_path(key, ".o", buff, sizeof(buff)) || !link_or_copy(buff, object)) {
+        objcache_counters.misses++;
+        return false;
+    }
+    objcache_counters.hits++;
+    return true;
+}
+
+// writes the headers of depfile as the manifest of the source key
+static uint64_t store_manifest(uint64_t key, const char* depfile_name) {
+    char buff[OBJCACHE_PATH_SIZE];
+    char temp[OBJCACHE_PATH_SIZE];
+    if (!entry_path(key, ".m", buff, sizeof(buff))
+        || !format_path(temp, sizeof(temp), "%s.%ld.tmp", buff, (long) getpid())) return 0;
+    depfile dep;
+    if (!depfile_read(depfile_name, &dep)) return 0;
+
+    FILE* fd = fopen(temp, "wb");
+    if (!fd) {
+        depfile_free(&dep);
+        return 0;
+    }
+    fprintf(fd, "manifest:");
+    vector_metainfo meta = vec_meta(dep.deps);
+    for (int i=0; i<meta.length; i++) {
+        // the source is already part of the key
+        if (i == 0) continue;
+        fprintf(fd, " \\\n ");
+        for (const char* ptr = dep.deps[i]; *ptr; ptr++) {
+            if (*ptr==' ' || *ptr=='#') fputc('\\', fd);
+            if (*ptr=='$') fputc('$', fd);
+            fputc(*ptr, fd);
+        }
+        key = combine(key, stat_content(stat_path(dep.deps[i])));
+    }
+    fprintf(fd, "\n");
+    depfile_free(&dep);
+    if (fclose(fd)!=0 || rename(temp, buff)!=0) {
+        remove(temp);
+        return 0;
+    }
+    return key;
+}
+
+static void read_cache_size() {
+    if (cache_size >= 0) return;
+    char buff[OBJCACHE_PATH_SIZE];
+    cache_size = 0;
+    if (!format_path(buff, sizeof(buff), "%s/%s", objcache_dir, OBJCACHE_SIZE_FILE)) return;
+    FILE* fd = fopen(buff, "r");
+    if (!fd) return;
+    long long size;
+    if (fscanf(fd, "%lld", &size)==1 && size > 0) cache_size = size;
+    fclose(fd);
+}
+
+static void write_cache_size() {
+    char buff[OBJCACHE_PATH_SIZE];
+    if (!format_path(buff, sizeof(buff), "%s/%s", objcache_dir, OBJCACHE_SIZE_FILE)) return;
+    FILE* fd = fopen(buff, "w");
+    if (!fd) return;
+    fprintf(fd, "%lld\n", (long long) cache_size);
+    fclose(fd);
+}
+
+void objcache_store(uint64_t key, const char* object, const char* depfile) {
+    char buff[OBJCACHE_PATH_SIZE];
+    if (!key) return;
+    make_dir(objcache_dir);
+    if (!format_path(buff, sizeof(buff), "%s/%02x", objcache_dir, (unsigned)(key >> 56))) return;
+    make_dir(buff);
+
+    if (objcache_direct) {
+        key = store_manifest(key, depfile);
+        if (!key) return;
+        if (!format_path(buff, sizeof(buff), "%s/%02x", objcache_dir, (unsigned)(key >> 56))) return;
+        make_dir(buff);
+    }
+
+    if (!entry_path(key, ".o", buff, sizeof(buff)) || !link_or_copy(object, buff)) return;
+    file_stat* st = stat_refresh(buff);
+    if (!entry_path(key, ".d", buff, sizeof(buff)) || !copy_file(depfile, buff)) return;
+
+    read_cache_size();
+    cache_size += st->size;
+    cache_added += st->size;
+    objcache_counters.stored++;
+}
+
+typedef struct cache_entry {
+    char* object;
+    char* depfile;
+    int64_t used;
+    int64_t size;
+} cache_entry;
+
+static int entry_compare(const void* a, const void* b) {
+    const cache_entry *x = a, *y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+static char* copy_string(const char* str) {
+    char* res = memloc(strlen(str)+1);
+    strcpy(res, str);
+    return res;
+}
+
+// walks the whole cache, so it only runs when the size file says the limit is exceeded
+static void evict() {
+    char buff[OBJCACHE_PATH_SIZE];
+    cache_entry* entries = new_vec(sizeof(cache_entry), PAGE_SIZE/sizeof(cache_entry));
+    int64_t total = 0;
+
+    DIR* top = opendir(objcache_dir);
+    if (!top) {
+        delete_vec(entries);
+        return;
+    }
+    struct dirent* sub;
+    while ((sub = readdir(top))) {
+        if (strlen(sub->d_name) != 2) continue;
+        char subdir[OBJCACHE_PATH_SIZE];
+        if (!format_path(subdir, sizeof(subdir), "%s/%s", objcache_dir, sub->d_name)) continue;
+        DIR* dir = opendir(subdir);
+        if (!dir) continue;
+        struct dirent* ent;
+        while ((ent = readdir(dir))) {
+            size_t len = strlen(ent->d_name);
+            if (len < 3 || strcmp(ent->d_name+len-2, ".o")!=0) continue;
+            struct stat info;
+            cache_entry entry;
+            if (!format_path(buff, sizeof(buff), "%s/%s", subdir, ent->d_name) || stat(buff, &info)!=0) continue;
+            entry.object = copy_string(buff);
+            entry.size = info.st_size;
+            buff[strlen(buff)-1] = 'd';
+            entry.used = (stat(buff, &info)==0) ? (int64_t) info.st_mtime : 0;
+            entry.depfile = copy_string(buff);
+            total += entry.size;
+            entries = vec_add(entries, &entry);
+        }
+        closedir(dir);
+    }
+    closedir(top);
+
+    vector_metainfo meta = vec_meta(entries);
+    qsort(entries, meta.length, sizeof(cache_entry), entry_compare);
+    // leave some room so the next run does not evict again
+    int64_t target = objcache_limit - objcache_limit/10;
+    for (int i=0; i<meta.length; i++) {
+        if (total > target) {
+            remove(entries[i].object);
+            remove(entries[i].depfile);
+            total -= entries[i].size;
+            objcache_counters.evicted++;
+        }
+        memfree(entries[i].object);
+        memfree(entries[i].depfile);
+    }
+    delete_vec(entries);
+    cache_size = total;
+}
+
+void objcache_trim() {
+    if (!objcache_dir || cache_added == 0) return;
+    read_cache_size();
+    if (cache_size > (int64_t) objcache_limit) evict();
+    write_cache_size();
+    cache_added = 0;
+}
+
+void objcache_report() {
+    if (!objcache_dir) return;
+    printf("\033[33mCache:\033[0m %zu hits, %zu misses", objcache_counters.hits, objcache_counters.misses);
+    if (objcache_counters.evicted) printf(", %zu evicted", objcache_counters.evicted);
+    printf("\n");
+}
@@ -0,0 +1,43 @@
+#ifndef s7k_objcache_lib
+#define s7k_objcache_lib
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memmanager.h"
+#include "vector.h"
+#include "hash.h"
+
+// objects are stored as <dir>/<first 2 hex digits>/<key>.o together with
+// their depfile <key>.d, mtime of the depfile marks the last use
+#define OBJCACHE_DEFAULT_LIMIT (1024ULL*1024*1024)
+
+extern char* objcache_dir; // NULL if the cache is off
+extern uint64_t objcache_limit; // in bytes
+// key on source and header contents instead of preprocessed source,
+// the depfiles are written with -MD so system headers are keyed too
+extern bool objcache_direct;
+
+typedef struct objcache_stats {
+    size_t hits, misses, stored, evicted;
+} objcache_stats;
+extern objcache_stats objcache_counters;
+
+// hash of compiler identity and compile flags, output paths excluded
+// @param args compiler arguments as passed to proc_start
+uint64_t objcache_base(char** args);
+// @return key of the preprocessed file ifile
+uint64_t objcache_key_preprocessed(uint64_t base, const char* ifile);
+// direct mode: key of the source, header contents are added by the manifest
+uint64_t objcache_key_source(uint64_t base, const char* source);
+
+// copies (hard links when possible) the cached object and its depfile
+// @return false on a miss
+bool objcache_fetch(uint64_t key, const char* object, const char* depfile);
+// puts freshly compiled object into the cache
+void objcache_store(uint64_t key, const char* object, const char* depfile);
+// evicts least recently used objects if the cache is over the limit
+void objcache_trim();
+void objcache_report();
+
+#endif
@@ -0,0 +1,219 @@
+#include "process.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#if !defined(WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+#define PROC_READ_SIZE 4096
+
+char** args_new() {
+    char** args = new_vec(sizeof(char*), STANDART_PREALLOC);
+    char* terminator = NULL;
+    return vec_add(args, &terminator);
+}
+
+char** args_add(char** args, const char* arg) {
+    size_t len = strlen(arg);
+    char* copy = memloc(len+1);
+    memcpy(copy, arg, len+1);
+
+    char* terminator = NULL;
+    vector_metainfo *meta = vec_metaptr(args);
+    args[meta->length-1] = copy;
+    return vec_add(args, &terminator);
+}
+
+char** args_split(char** args, const char* line) {
+    if (!line) return args;
+    size_t len = strlen(line);
+    char* buff = memloc(len+1);
+    const char* ptr = line;
+    while (*ptr) {
+        while (*ptr && (*ptr==' ' || *ptr=='\t' || *ptr=='\n' || *ptr=='\r')) ptr++;
+        if (!*ptr) break;
+
+        size_t size = 0;
+        char quote = 0;
+        while (*ptr) {
+            if (quote) {
+                if (*ptr == quote) quote = 0;
+                else buff[size++] = *ptr;
+            } else if (*ptr=='"' || *ptr=='\'') {
+                quote = *ptr;
+            } else if (*ptr==' ' || *ptr=='\t' || *ptr=='\n' || *ptr=='\r') {
+                break;
+            } else {
+                buff[size++] = *ptr;
+            }
+            ptr++;
+        }
+        buff[size] = '\0';
+        args = args_add(args, buff);
+    }
+    memfree(buff);
+    return args;
+}
+
+size_t args_count(char** args) {
+    return vec_meta(args).length - 1;
+}
+
+char* args_join(char** args) {
+    size_t count = args_count(args);
+    size_t len = 1;
+    for (int i=0; i<count; i++) len += strlen(args[i]) + 3;
+
+    char* line = memloc(len);
+    size_t cursor = 0;
+    for (int i=0; i<count; i++) {
+        bool quote = (strchr(args[i], ' ') != NULL || args[i][0] == '\0');
+        if (i != 0) line[cursor++] = ' ';
+        if (quote) line[cursor++] = '"';
+        size_t arglen = strlen(args[i]);
+        memcpy(line+cursor, args[i], arglen);
+        cursor += arglen;
+        if (quote) line[cursor++] = '"';
+    }
+    line[cursor] = '\0';
+    return line;
+}
+
+void args_free(char** args) {
+    size_t count = args_count(args);
+    for (int i=0; i<count; i++) memfree(args[i]);
+    delete_vec(args);
+}
+
+#if defined(WIN32)
+
+// no posix_spawn here: the command goes through the shell and runs to completion
+bool proc_start(process* proc, char** args) {
+    char* line = args_join(args);
+    proc->pid = 0;
+    proc->err_fd = -1;
+    proc->err = NULL;
+    proc->status = system(line);
+    memfree(line);
+    return true;
+}
+
+int proc_wait_any(process** procs, size_t count) {
+    if (count == 0) return -1;
+    return 0;
+}
+
+#else
+
+bool proc_start(process* proc, char** args) {
+    int pipefd[2];
+    proc->pid = -1;
+    proc->status = -1;
+    proc->err_fd = -1;
+    proc->err = NULL;
+
+    if (pipe(pipefd) != 0) return false;
+    // other compilers started in parallel must not inherit the pipe,
+    // otherwise EOF on it comes only after all of them finish
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], 2);
+
+    int code = posix_spawnp(&proc->pid, args[0], &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+
+    if (code != 0) {
+        close(pipefd[0]);
+        proc->pid = -1;
+        fprintf(stderr, "Cannot start %s: %s\n", args[0], strerror(code));
+        return false;
+    }
+    proc->err_fd = pipefd[0];
+    proc->err = new_vec(sizeof(char), 0);
+    return true;
+}
+
+void proc_reap(process* proc) {
+    int status;
+    while (waitpid(proc->pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            proc->status = -1;
+            return;
+        }
+    }
+    proc->status = (WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+int proc_wait_any(process** procs, size_t count) {
+    if (count == 0) return -1;
+    struct pollfd fds[count];
+    int owner[count];
+    char buff[PROC_READ_SIZE];
+
+    while (true) {
+        size_t n = 0;
+        for (int i=0; i<count; i++) {
+            // stderr is closed before exit, so the process is done or about to be
+            if (procs[i]->err_fd < 0) {
+                proc_reap(procs[i]);
+                return i;
+            }
+            fds[n].fd = procs[i]->err_fd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            owner[n] = i;
+            n++;
+        }
+
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        for (int k=0; k<n; k++) {
+            if (!fds[k].revents) continue;
+            process* proc = procs[owner[k]];
+            ssize_t got = read(proc->err_fd, buff, PROC_READ_SIZE);
+            if (got > 0) {
+                proc->err = vec_extend(proc->err, buff, got);
+            } else if (got == 0 || errno != EINTR) {
+                close(proc->err_fd);
+                proc->err_fd = -1;
+            }
+        }
+    }
+}
+
+#endif
+
+bool proc_run(process* proc, char** args) {
+    if (!proc_start(proc, args)) return false;
+    process* procs[1] = {proc};
+    if (proc_wait_any(procs, 1) < 0) return false;
+    return proc->status == 0;
+}
+
+void proc_print_err(process* proc, FILE* fd) {
+    if (!proc->err) return;
+    vector_metainfo meta = vec_meta(proc->err);
+    if (meta.length == 0) return;
+    fwrite(proc->err, sizeof(char), meta.length, fd);
+    fflush(fd);
+}
+
+void proc_free(process* proc) {
+    if (proc->err) delete_vec(proc->err);
+    proc->err = NULL;
+}
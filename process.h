@@ -0,0 +1,43 @@
+#ifndef s7k_process_lib
+#define s7k_process_lib
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "memmanager.h"
+#include "vector.h"
+
+typedef struct process {
+    pid_t pid;
+    int status; // exit code, -1 if the process was killed or could not start
+    int err_fd; // read end of the stderr pipe, -1 when closed
+    char* err; // vector of captured stderr bytes
+} process;
+
+// argument lists are NULL-terminated vectors of strings,
+// so they can be passed to exec as they are
+
+char** args_new();
+// copies arg to the end of args
+char** args_add(char** args, const char* arg);
+// splits line by whitespace, text in quotes stays one argument
+char** args_split(char** args, const char* line);
+// @return number of arguments without the terminating NULL
+size_t args_count(char** args);
+// joins arguments into one command line, quoting the ones with spaces
+// @return string allocated by memloc
+char* args_join(char** args);
+void args_free(char** args);
+
+// starts args[0] (searched in PATH) without a shell, stderr is captured
+bool proc_start(process* proc, char** args);
+// waits for any of the processes to finish, reading their stderr meanwhile
+// @return index of the finished process, -1 if there is nothing to wait for
+int proc_wait_any(process** procs, size_t count);
+// starts process and waits for it
+bool proc_run(process* proc, char** args);
+// prints captured stderr to fd
+void proc_print_err(process* proc, FILE* fd);
+void proc_free(process* proc);
+
+#endif
@@ -0,0 +1,79 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct trace_entry {
+    char* name;
+    const char* category;
+    int tid;
+    int64_t start, stop;
+} trace_entry;
+
+bool trace_enabled = false;
+char* trace_path = NULL;
+trace_entry* trace_events = NULL; // vector
+int64_t trace_origin = 0;
+
+int64_t trace_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+int64_t trace_ms(int64_t start, int64_t stop) {
+    return (stop - start)/1000000;
+}
+
+void trace_open(const char* path) {
+    size_t len = strlen(path);
+    trace_path = memloc(len+1);
+    memcpy(trace_path, path, len+1);
+    trace_events = new_vec(sizeof(trace_entry), PAGE_SIZE/sizeof(trace_entry));
+    trace_origin = trace_now();
+    trace_enabled = true;
+}
+
+void trace_event(const char* name, const char* category, int tid, int64_t start, int64_t stop) {
+    if (!trace_enabled) return;
+    size_t len = strlen(name);
+    trace_entry entry;
+    entry.name = memloc(len+1);
+    memcpy(entry.name, name, len+1);
+    entry.category = category;
+    entry.tid = tid;
+    entry.start = start;
+    entry.stop = stop;
+    trace_events = vec_add(trace_events, &entry);
+}
+
+static void write_string(FILE* fd, const char* str) {
+    fputc('"', fd);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') fputc('\\', fd);
+        if ((unsigned char) *str < 32) fprintf(fd, "\\u%04x", *str);
+        else fputc(*str, fd);
+    }
+    fputc('"', fd);
+}
+
+bool trace_save() {
+    if (!trace_enabled) return true;
+    FILE* fd = fopen(trace_path, "w");
+    if (!fd) return false;
+    fprintf(fd, "{\"traceEvents\":[\n");
+    fprintf(fd, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"builder\"}}", TRACE_MAIN);
+    vector_metainfo meta = vec_meta(trace_events);
+    for (int i=0; i<meta.length; i++) {
+        trace_entry* entry = trace_events+i;
+        fprintf(fd, ",\n{\"name\":");
+        write_string(fd, entry->name);
+        // microseconds since the start of the run
+        fprintf(fd, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            entry->category, entry->tid,
+            (entry->start - trace_origin)/1000.0, (entry->stop - entry->start)/1000.0);
+    }
+    fprintf(fd, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(fd)==0;
+}
@@ -0,0 +1,27 @@
+#ifndef s7k_trace_lib
+#define s7k_trace_lib
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memmanager.h"
+#include "vector.h"
+
+// thread id of events that are not jobs, jobs use their slot + 1
+#define TRACE_MAIN 0
+
+extern bool trace_enabled;
+
+// @return monotonic time in nanoseconds
+int64_t trace_now();
+// @return whole milliseconds between two trace_now() values
+int64_t trace_ms(int64_t start, int64_t stop);
+
+// starts collecting events, they are written by trace_save()
+void trace_open(const char* path);
+// records a complete event, times are trace_now() values
+void trace_event(const char* name, const char* category, int tid, int64_t start, int64_t stop);
+// writes all events so far in Chrome trace-event format
+bool trace_save();
+
+#endif
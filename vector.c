@@ -3,11 +3,28 @@
 allocator_type *allocator = malloc;
 deallocator_type *deallocator = free;
 memcopy_type *memcopy = memcpy;
+reallocator_type *reallocator = realloc;
 
-void set_funcs(allocator_type al, deallocator_type del, memcopy_type mc) {
+void set_funcs(allocator_type al, deallocator_type del, memcopy_type mc, reallocator_type re) {
     allocator = al;
     deallocator = del;
     memcopy = mc;
+    reallocator = re;
+}
+
+// @return meta with room for capacity elements, moved or grown in place
+static vector_metainfo* grow_meta(vector_metainfo* meta, size_t capacity) {
+    size_t bytes = sizeof(vector_metainfo) + capacity*meta->size;
+    vector_metainfo* grown = reallocator(meta, bytes);
+    if (!grown) {
+        // made before the allocator was switched, or a frozen vector,
+        // memfree() ignores both
+        grown = allocator(bytes);
+        memcopy(grown, meta, sizeof(vector_metainfo) + meta->length*meta->size);
+        deallocator(meta);
+    }
+    grown->capacity = capacity;
+    return grown;
 }
 
 vector new_vec(size_t elem_size, size_t prealloc) {
@@ -33,25 +50,31 @@ void delete_vec(vector vec) {
 vector vec_add(vector vec, void* elem) {
     check_not_null(vec);   
     vector_metainfo *meta = (vector_metainfo*)vec - 1;
-    if (meta->capacity == 0) {
-        vector nv = new_vec(meta->size, STANDART_PREALLOC);
-        delete_vec(vec);
-        vec = nv;
-        meta = (vector_metainfo*)vec - 1;
-    } else if (meta->capacity == meta->length) {
-        vector nv = new_vec(meta->size, (size_t)(meta->length*2));
-        memcopy(nv, vec, meta->length*meta->size);
-        vector_metainfo *newmeta = (vector_metainfo*)nv - 1;
-        newmeta->length = meta->length;
-        delete_vec(vec);
-        vec = nv;
-        meta = newmeta;
+    if (meta->capacity == meta->length) {
+        size_t capacity = (meta->capacity) ? meta->capacity*2 : STANDART_PREALLOC;
+        // grows in place if the allocator can
+        meta = grow_meta(meta, capacity);
+        vec = (void*) (meta + 1);
     }
     memcopy(vec + meta->length*meta->size, elem, meta->size);
     meta->length += 1;
     return vec;
 }
 
+vector vec_extend(vector vec, void* elems, size_t count) {
+    check_not_null(vec);
+    vector_metainfo *meta = (vector_metainfo*)vec - 1;
+    if (meta->length + count > meta->capacity) {
+        size_t capacity = meta->capacity*2;
+        if (capacity < meta->length + count) capacity = meta->length + count;
+        meta = grow_meta(meta, capacity);
+        vec = (void*) (meta + 1);
+    }
+    memcopy(vec + meta->length*meta->size, elems, count*meta->size);
+    meta->length += count;
+    return vec;
+}
+
 void vec_remove(vector vec, size_t index) {
     check_not_null(vec);   
     vector_metainfo *meta = (vector_metainfo*)vec - 1;
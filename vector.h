@@ -10,12 +10,15 @@
 typedef void*(allocator_type)(size_t);
 typedef void(deallocator_type)(void*);
 typedef void*(memcopy_type)(void* dest, const void* src, size_t numbytes);
+// may return NULL for blocks of another allocator, they are copied then
+typedef void*(reallocator_type)(void*, size_t);
 
 extern allocator_type *allocator;
 extern deallocator_type *deallocator;
 extern memcopy_type *memcopy;
+extern reallocator_type *reallocator;
 
-void set_funcs(allocator_type, deallocator_type, memcopy_type);
+void set_funcs(allocator_type, deallocator_type, memcopy_type, reallocator_type);
 
 typedef struct {
     size_t length; // number of elements
@@ -25,6 +28,8 @@ typedef struct {
 
 typedef void* vector;
 vector vec_add(vector vec, void* elem);
+// appends count elements at once
+vector vec_extend(vector vec, void* elems, size_t count);
 // @note index MUST be in range
 void vec_remove(vector vec, size_t index);
 
@@ -0,0 +1,154 @@
+#include "watch.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_BUFFER_SIZE 65536
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB)
+
+typedef struct watched_dir {
+    int wd;
+    char* path; // without trailing '/', "." for the current directory
+} watched_dir;
+
+int watch_fd = -1;
+watched_dir* watched = NULL; // vector
+
+bool watch_init() {
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if (watch_fd < 0) return false;
+    watched = new_vec(sizeof(watched_dir), STANDART_PREALLOC);
+    return true;
+}
+
+static void watch_dir(const char* dir, size_t len) {
+    while (len > 1 && dir[len-1] == '/') len--;
+    if (len == 0) {
+        dir = ".";
+        len = 1;
+    }
+    vector_metainfo meta = vec_meta(watched);
+    for (int i=0; i<meta.length; i++) {
+        if (strlen(watched[i].path) == len && strncmp(watched[i].path, dir, len)==0) return;
+    }
+
+    watched_dir entry;
+    entry.path = memloc(len+1);
+    memcpy(entry.path, dir, len);
+    entry.path[len] = '\0';
+    entry.wd = inotify_add_watch(watch_fd, entry.path, WATCH_EVENTS);
+    if (entry.wd < 0) {
+        memfree(entry.path);
+        return;
+    }
+    watched = vec_add(watched, &entry);
+}
+
+void watch_path(const char* path) {
+    if (watch_fd < 0) return;
+    struct stat info;
+    if (stat(path, &info)==0 && S_ISDIR(info.st_mode)) {
+        watch_dir(path, strlen(path));
+        return;
+    }
+    const char* slash = strrchr(path, '/');
+    watch_dir(path, (slash) ? (size_t)(slash-path) : 0);
+}
+
+static const char* dir_of(int wd) {
+    vector_metainfo meta = vec_meta(watched);
+    for (int i=0; i<meta.length; i++) {
+        if (watched[i].wd == wd) return watched[i].path;
+    }
+    return NULL;
+}
+
+static char** read_events(char** changed, char* buff) {
+    ssize_t got = read(watch_fd, buff, WATCH_BUFFER_SIZE);
+    for (char* ptr = buff; got > 0 && ptr < buff+got; ) {
+        struct inotify_event* event = (struct inotify_event*) ptr;
+        ptr += sizeof(struct inotify_event) + event->len;
+        const char* dir = dir_of(event->wd);
+        if (!dir || event->len == 0) continue;
+
+        size_t dirlen = strlen(dir), namelen = strlen(event->name);
+        char* path;
+        if (strcmp(dir, ".")==0) {
+            path = memloc(namelen+1);
+            memcpy(path, event->name, namelen+1);
+        } else {
+            path = memloc(dirlen+namelen+2);
+            memcpy(path, dir, dirlen);
+            path[dirlen] = '/';
+            memcpy(path+dirlen+1, event->name, namelen+1);
+        }
+        changed = vec_add(changed, &path);
+    }
+    return changed;
+}
+
+char** watch_wait(int settle_ms) {
+    if (watch_fd < 0) return NULL;
+    char* buff = memloc(WATCH_BUFFER_SIZE);
+    char** changed = new_vec(sizeof(char*), STANDART_PREALLOC);
+    struct pollfd pfd = {watch_fd, POLLIN, 0};
+
+    // editors save in several steps, so take everything until it is quiet again
+    int timeout = -1;
+    while (true) {
+        int res = poll(&pfd, 1, timeout);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            memfree(buff);
+            watch_free(changed);
+            return NULL;
+        }
+        if (res == 0) break;
+        changed = read_events(changed, buff);
+        timeout = settle_ms;
+    }
+    memfree(buff);
+    return changed;
+}
+
+void watch_close() {
+    if (watch_fd < 0) return;
+    close(watch_fd);
+    watch_fd = -1;
+    vector_metainfo meta = vec_meta(watched);
+    for (int i=0; i<meta.length; i++) memfree(watched[i].path);
+    delete_vec(watched);
+    watched = NULL;
+}
+
+#else
+
+bool watch_init() {
+    return false;
+}
+
+void watch_path(const char* path) {
+}
+
+char** watch_wait(int settle_ms) {
+    return NULL;
+}
+
+void watch_close() {
+}
+
+#endif
+
+void watch_free(char** changed) {
+    if (!changed) return;
+    vector_metainfo meta = vec_meta(changed);
+    for (int i=0; i<meta.length; i++) memfree(changed[i]);
+    delete_vec(changed);
+}
@@ -0,0 +1,22 @@
+#ifndef s7k_watch_lib
+#define s7k_watch_lib
+
+#include <stdbool.h>
+
+#include "memmanager.h"
+#include "vector.h"
+
+// time to wait after the first change for the rest of the batch
+#define WATCH_SETTLE_MS 100
+
+// @return false if watching files is not supported here
+bool watch_init();
+// watches the directory of path, or path itself if it is a directory
+void watch_path(const char* path);
+// blocks until something changes, then collects the changes for settle_ms more
+// @return vector of changed paths allocated with memloc, NULL on error
+char** watch_wait(int settle_ms);
+void watch_free(char** changed);
+void watch_close();
+
+#endif